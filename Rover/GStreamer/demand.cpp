@@ -0,0 +1,65 @@
+#include "demand.h"
+
+using namespace std;
+
+int standby_seconds = 10;
+
+static gboolean
+standby_over (gpointer data)
+{
+    demand * d = (demand *) data;
+    lock_guard<mutex> guard(d->lock);
+    d->timer = 0;
+    if (d->medias == 0 && d->running)
+    {
+        d->running = false;
+        d->stop();
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void
+media_unprepared (GstRTSPMedia * media, gpointer data)
+{
+    demand * d = (demand *) data;
+    lock_guard<mutex> guard(d->lock);
+    if (--d->medias > 0)
+    {
+        return;
+    }
+    if (d->standby <= 0)
+    {
+        d->running = false;
+        d->stop();
+    }
+    else
+    {
+        d->timer = g_timeout_add_seconds(d->standby, standby_over, d);
+    }
+}
+
+// a shared factory makes one media for all the clients of its mount
+static void
+media_configure (GstRTSPMediaFactory * factory, GstRTSPMedia * media, gpointer data)
+{
+    demand * d = (demand *) data;
+    lock_guard<mutex> guard(d->lock);
+    d->medias++;
+    if (d->timer != 0)
+    {
+        g_source_remove(d->timer);
+        d->timer = 0;
+    }
+    if (!d->running)
+    {
+        d->running = true;
+        d->start();
+    }
+    g_signal_connect(media, "unprepared", G_CALLBACK(media_unprepared), d);
+}
+
+void
+watch_factory (GstRTSPMediaFactory * factory, demand * d)
+{
+    g_signal_connect(factory, "media-configure", G_CALLBACK(media_configure), d);
+}
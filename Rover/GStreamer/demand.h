@@ -0,0 +1,33 @@
+#ifndef DEMAND_H_   /* Include guard */
+#define DEMAND_H_
+
+#include <functional>
+#include <mutex>
+#include <gst/rtsp-server/rtsp-server.h>
+
+// how long work keeps running after the last client left, in case one comes back
+extern int standby_seconds;
+
+/*
+ * Work that only has to run while someone watches, like reading a camera.
+ * start runs when the first client of any factory watched with it connects,
+ * and stop once the last one has been gone for standby seconds. A client
+ * coming back within that time finds it still running.
+ */
+struct demand
+{
+    std::function<void()> start;
+    std::function<void()> stop;
+    int standby = standby_seconds;
+
+    // kept by the factories' signals
+    std::mutex lock;
+    int medias = 0;
+    guint timer = 0;
+    bool running = false;
+};
+
+// counts every media factory makes toward d, so d runs while any of them is up
+void watch_factory (GstRTSPMediaFactory * factory, demand * d);
+
+#endif // DEMAND_H_
@@ -4,6 +4,14 @@
 #include <gst/gst.h>
 #include <unistd.h>
 #include <cstring>
+#include <cctype>
+#include <set>
+#include <string>
+
+#include "server.h"
+
+// all cameras are served here, rtsp://rover:8554/<camera>/feed<n>
+#define SCANNER_PORT "8554"
 
 #ifdef DEBUG
 void structure_fields(const GstStructure *device) 
@@ -41,13 +49,58 @@ GstDeviceMonitor *device_monitor(void)
   return monitor;
 }
 
+// the camera's name as a mount, "USB 2.0 Camera" is /usb-2-0-camera, the second one /usb-2-0-camera-2
+std::string mount_name(const char * name, std::set<std::string> &taken)
+{
+  std::string base = "/";
+  for (const char * c = name; *c; c++)
+  {
+    if (isalnum((unsigned char) *c))
+    {
+      base += (char) tolower((unsigned char) *c);
+    }
+    else if (base.back() != '-')
+    {
+      base += '-';
+    }
+  }
+  while (base.size() > 1 && base.back() == '-')
+  {
+    base.pop_back();
+  }
+  std::string mount = base;
+  for (int n = 2; taken.count(mount); n++)
+  {
+    mount = base + "-" + std::to_string(n);
+  }
+  taken.insert(mount);
+  return mount;
+}
+
+/*
+ * ./device-scanner [port] [standby seconds]
+ *
+ * Serves every camera it finds from this one process: one RTSP server, one
+ * main loop, and a mount per camera. The ZED goes to zed-depth instead, which
+ * needs the camera for depth and streams what it sees itself. A camera is
+ * only read while someone watches it, and for standby seconds after.
+ */
 int main(int argc, char *argv[]) 
 {
   GstDeviceMonitor *monitor;
   GList *dev;
   GMainLoop *loop;
+  GstRTSPServer *server;
+  std::set<std::string> mounts;
   gst_init(&argc, &argv);
 
+  server = gst_rtsp_server_new();
+  g_object_set(server, "service", argc > 1 ? argv[1] : SCANNER_PORT, NULL);
+  if (argc > 2)
+  {
+    standby_seconds = atoi(argv[2]);
+  }
+
   // create the monitor
   monitor = device_monitor();
   dev = gst_device_monitor_get_devices(monitor);
@@ -64,24 +117,27 @@ int main(int argc, char *argv[])
 #endif
     const char * name = gst_device_get_display_name(devi);
     const char * path = gst_structure_get_string(type, "device.path");
-    g_print("Device-Scanner > Starting process for %s camera at %s\n", name, path);
-    int mypid = fork();
-    if(mypid == 0)
+    if (strcmp(name, "ZED") == 0) 
     {
-      int ret;
-      if (strcmp(name, "ZED") == 0) 
+      g_print("Device-Scanner > Starting zed-depth for the ZED at %s\n", path);
+      int mypid = fork();
+      if(mypid == 0)
       {
-        ret = execl("../zed_depth/zed_depth", argv[0]);
+        int ret = execl("../ZedDepth/zed-depth", "zed-depth", NULL);
+        return ret; // Shouldn't reach this line
       }
-      else
-      {
-        ret = execl("./server-wrapper", argv[0], name, path, NULL);
-      }
-      return ret; // Shouldn't reach this line
+    }
+    else
+    {
+      g_print("Device-Scanner > Serving %s camera at %s\n", name, path);
+      add_camera(server, name, path, mount_name(name, mounts).c_str());
     }
     cur = g_list_next(cur);
   }
 
+  /* attach the server to the default maincontext, every camera runs on it */
+  gst_rtsp_server_attach(server, NULL);
+
   loop = g_main_loop_new(NULL, FALSE);
   g_main_loop_run(loop);
   g_main_loop_unref(loop);
@@ -0,0 +1,121 @@
+#include <gst/gst.h>
+#include <cstdio>
+
+#include "encoder.h"
+
+using namespace std;
+
+static const char * encoder_elements[] = { "omxh264enc", "x264enc", "openh264enc", "jpegenc", NULL };
+
+static encoder_kind
+find_encoder ()
+{
+    for (int i = 0; encoder_elements[i] != NULL; i++)
+    {
+        GstElementFactory * factory = gst_element_factory_find(encoder_elements[i]);
+        if (factory != NULL)
+        {
+            gst_object_unref(factory);
+            g_print("Encoding with %s\n", encoder_elements[i]);
+            return (encoder_kind) i;
+        }
+    }
+    g_print("No encoder found, streaming uncompressed\n");
+    return ENCODER_RAW;
+}
+
+encoder_kind
+probe_encoder ()
+{
+    // every server thread asks, the first one looks
+    static const encoder_kind kind = find_encoder();
+    return kind;
+}
+
+const char *
+encoder_name (encoder_kind kind)
+{
+    return kind == ENCODER_RAW ? "rtpvrawpay, no encoder found" : encoder_elements[kind];
+}
+
+string
+encoder_launch (encoder_kind kind, int bitrate, int gop)
+{
+    char output[512];
+    switch (kind)
+    {
+        case ENCODER_OMX:
+            // bitrate is in bit/s here
+            snprintf(output, 512, "omxh264enc name=" ENCODER_NAME " control-rate=variable bitrate=%d iframeinterval=%d ! video/x-h264, stream-format=(string)byte-stream ! h264parse", bitrate * 1000, gop);
+            break;
+        case ENCODER_X264:
+            snprintf(output, 512, "x264enc name=" ENCODER_NAME " tune=zerolatency speed-preset=ultrafast bframes=0 key-int-max=%d bitrate=%d ! video/x-h264, profile=baseline ! h264parse", gop, bitrate);
+            break;
+        case ENCODER_OPENH264:
+            // baseline only, so there are no B-frames to turn off
+            snprintf(output, 512, "openh264enc name=" ENCODER_NAME " rate-control=bitrate complexity=low gop-size=%d bitrate=%d ! h264parse", gop, bitrate * 1000);
+            break;
+        case ENCODER_JPEG:
+            snprintf(output, 512, "jpegenc name=" ENCODER_NAME " quality=60");
+            break;
+        default:
+            snprintf(output, 512, "identity");
+            break;
+    }
+    return output;
+}
+
+const char *
+encoder_payloader (encoder_kind kind)
+{
+    switch (kind)
+    {
+        case ENCODER_JPEG:
+            return "rtpjpegpay";
+        case ENCODER_RAW:
+            return "rtpvrawpay";
+        default:
+            return "rtph264pay";
+    }
+}
+
+string
+encoder_rtp (int bitrate, int gop)
+{
+    encoder_kind kind = probe_encoder();
+    string pipeline = encoder_launch(kind, bitrate, gop);
+    pipeline += " ! ";
+    pipeline += encoder_payloader(kind);
+    // the stream parameters go with every keyframe, for clients that join late
+    if (kind != ENCODER_JPEG && kind != ENCODER_RAW)
+    {
+        pipeline += " config-interval=-1";
+    }
+    pipeline += " name=pay0 pt=96";
+    return pipeline;
+}
+
+void
+set_encoder_bitrate (GstElement * encoder, encoder_kind kind, int bitrate)
+{
+    switch (kind)
+    {
+        case ENCODER_X264:
+            g_object_set(G_OBJECT(encoder), "bitrate", (guint) bitrate, NULL);
+            break;
+        case ENCODER_OMX:
+        case ENCODER_OPENH264:
+            g_object_set(G_OBJECT(encoder), "bitrate", (guint) bitrate * 1000, NULL);
+            break;
+        default:
+            break;
+    }
+}
+
+int
+default_bitrate (int width, int height, int fps)
+{
+    // about a tenth of a bit per pixel, enough for a rover moving slowly
+    long bitrate = (long) width * height * fps / 10000;
+    return bitrate < 100 ? 100 : (int) bitrate;
+}
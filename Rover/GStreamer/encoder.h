@@ -0,0 +1,44 @@
+#ifndef ENCODER_H_   /* Include guard */
+#define ENCODER_H_
+
+#include <string>
+#include <gst/gst.h>
+
+// the encoder in what encoder_launch gives, to find it in the pipeline
+#define ENCODER_NAME "enc"
+
+// the encoders we can stream with, best first
+enum encoder_kind
+{
+    ENCODER_OMX,        // omxh264enc, the Jetson's hardware encoder
+    ENCODER_X264,       // x264enc
+    ENCODER_OPENH264,   // openh264enc
+    ENCODER_JPEG,       // jpegenc, every frame on its own, no bitrate control
+    ENCODER_RAW         // nothing installed, uncompressed I420 like before
+};
+
+// the first encoder in encoder_kind that is installed, looked up once. Needs gst_init.
+encoder_kind probe_encoder ();
+
+const char * encoder_name (encoder_kind kind);
+
+/*
+ * Launch description of the encoder set up for latency: no B-frames, a keyframe
+ * every gop frames so a client joining or losing a packet recovers quickly, and
+ * bitrate in kbit/s. Takes I420, gives what encoder_payloader packs.
+ */
+std::string encoder_launch (encoder_kind kind, int bitrate, int gop);
+
+// the RTP payloader for what the encoder gives
+const char * encoder_payloader (encoder_kind kind);
+
+// the probed encoder and its payloader as pay0, the end of an rtsp mount
+std::string encoder_rtp (int bitrate, int gop);
+
+// changes the bitrate of a running encoder, in kbit/s. Does nothing for jpegenc and raw.
+void set_encoder_bitrate (GstElement * encoder, encoder_kind kind, int bitrate);
+
+// a bitrate in kbit/s that looks fine for a stream of this size and rate
+int default_bitrate (int width, int height, int fps);
+
+#endif // ENCODER_H_
@@ -0,0 +1,139 @@
+#include <gst/gst.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "timestamp.h"
+
+using namespace std;
+
+// frame ages since the last report, in ms
+static mutex ages_lock;
+static vector<double> ages;
+static long unstamped = 0;
+
+// the last packet of a frame is the one with the marker, the frame is all there then
+static GstPadProbeReturn
+packet_arrived(GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+    GstBuffer * buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+    bool marker = gst_rtp_buffer_get_marker(&rtp);
+    gst_rtp_buffer_unmap(&rtp);
+    if (!marker)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    guint64 capture_ns;
+    lock_guard<mutex> guard(ages_lock);
+    if (read_capture(buffer, capture_ns))
+    {
+        ages.push_back(((double) wall_clock_ns() - (double) capture_ns) / 1e6);
+    }
+    else
+    {
+        unstamped++;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static double
+percentile(const vector<double> &sorted, double p)
+{
+    return sorted[min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+static gboolean
+report(gpointer data)
+{
+    vector<double> sorted;
+    long missing;
+    {
+        lock_guard<mutex> guard(ages_lock);
+        sorted.swap(ages);
+        missing = unstamped;
+        unstamped = 0;
+    }
+    if (sorted.empty())
+    {
+        g_print("no stamped frames, %ld without a capture time\n", missing);
+        return G_SOURCE_CONTINUE;
+    }
+    sort(sorted.begin(), sorted.end());
+    g_print("%zu frames, age ms: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f", sorted.size(),
+            sorted.front(), percentile(sorted, 0.5), percentile(sorted, 0.9), percentile(sorted, 0.99), sorted.back());
+    if (missing > 0)
+    {
+        g_print(", %ld without a capture time", missing);
+    }
+    g_print("\n");
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * ./latency-probe <rtsp://rover:8554/usb-2-0-camera/feed0 | udp port> [seconds]
+ *
+ * Receives a stream and prints how old its frames are when their last packet
+ * arrives, from the capture time the rover put in each packet. The two clocks
+ * have to agree, run it on the rover itself or keep both on NTP. Decoding and
+ * showing the frame come on top of what it prints.
+ */
+int
+main(int argc, char *argv[])
+{
+    gst_init(&argc, &argv);
+    if (argc < 2)
+    {
+        g_print("Usage ./latency-probe <rtsp url | udp port> [seconds between reports]\n");
+        return 1;
+    }
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+
+    char launch[512];
+    if (strncmp(argv[1], "rtsp://", 7) == 0)
+    {
+        // no jitter buffer delay, packets are looked at as they come
+        snprintf(launch, 512, "rtspsrc location=%s latency=0 ! fakesink name=sink sync=false", argv[1]);
+    }
+    else
+    {
+        snprintf(launch, 512, "udpsrc port=%d caps=\"application/x-rtp\" ! fakesink name=sink sync=false", atoi(argv[1]));
+    }
+    GError * error = NULL;
+    GstElement * pipeline = gst_parse_launch(launch, &error);
+    if (pipeline == NULL)
+    {
+        g_print("Couldn't make the pipeline: %s\n", error ? error->message : "unknown error");
+        return 1;
+    }
+    g_clear_error(&error);
+
+    GstElement * sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstPad * pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, packet_arrived, NULL, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(sink);
+
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    {
+        g_print("Couldn't start receiving %s\n", argv[1]);
+        return 1;
+    }
+    g_print("Receiving %s\n", argv[1]);
+
+    GMainLoop * loop = g_main_loop_new(NULL, FALSE);
+    g_timeout_add_seconds(seconds, report, NULL);
+    g_main_loop_run(loop);
+    g_main_loop_unref(loop);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+
+#include "ratecontrol.h"
+
+using namespace std;
+
+// past these a receiver is losing frames or getting them late
+static const float congested_loss = 0.05f;
+static const float congested_rtt_ms = 400.0f;
+static const float congested_jitter_ms = 100.0f;
+// below this loss the link has room
+static const float clear_loss = 0.01f;
+static const int clear_reports_to_step_up = 5;
+
+rate_controller::rate_controller(int max_bitrate, int max_fps)
+    : max_bitrate(max_bitrate), min_bitrate(max(max_bitrate / 4, 1)),
+      max_fps(max_fps), min_fps(max(max_fps / 4, 1))
+{
+    current.bitrate = max_bitrate;
+    current.fps = max_fps;
+    current.step = 0;
+}
+
+bool
+rate_controller::update(const link_report &report)
+{
+    stream_settings before = current;
+    bool congested = report.loss > congested_loss || report.rtt_ms > congested_rtt_ms || report.jitter_ms > congested_jitter_ms;
+    if (congested)
+    {
+        // multiplicative decrease, the cheapest thing to give up first
+        clear_reports = 0;
+        if (current.bitrate > min_bitrate)
+        {
+            current.bitrate = max(min_bitrate, current.bitrate * 7 / 10);
+        }
+        else if (current.fps > min_fps)
+        {
+            current.fps = max(min_fps, current.fps / 2);
+        }
+        else if (current.step < RATE_STEPS - 1)
+        {
+            current.step++;
+        }
+    }
+    else if (report.loss < clear_loss)
+    {
+        // additive increase, and the steps back up in the opposite order
+        clear_reports++;
+        if (clear_reports >= clear_reports_to_step_up && current.step > 0)
+        {
+            current.step--;
+            clear_reports = 0;
+        }
+        else if (clear_reports >= clear_reports_to_step_up && current.fps < max_fps)
+        {
+            current.fps = min(max_fps, current.fps * 2);
+            clear_reports = 0;
+        }
+        else if (current.step == 0 && current.fps == max_fps)
+        {
+            current.bitrate = min(max_bitrate, current.bitrate + max(max_bitrate / 20, 1));
+        }
+    }
+    // in between, hold and see
+    return current.bitrate != before.bitrate || current.fps != before.fps || current.step != before.step;
+}
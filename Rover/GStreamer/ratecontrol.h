@@ -0,0 +1,45 @@
+#ifndef RATECONTROL_H_   /* Include guard */
+#define RATECONTROL_H_
+
+// what a receiver says about the link in an RTCP receiver report
+struct link_report
+{
+    float loss;       // share of the packets lost since its last report, 0 to 1
+    float jitter_ms;
+    float rtt_ms;     // 0 until the sender report it answers has come back
+};
+
+// what a mount sends
+struct stream_settings
+{
+    int bitrate;      // kbit/s
+    int fps;
+    int step;         // of the size ladder, 0 is the mount's own size and each step is 3/4 of the one before
+};
+
+#define RATE_STEPS 3
+
+/*
+ * Steps a stream down when its receivers report a bad link and back up when
+ * it is clear again. Bitrate goes down first, by 30% per bad report down to a
+ * quarter of the most. Then the frame rate halves, and then the size steps
+ * down. A clear report adds a twentieth of the most to the bitrate, and five
+ * in a row undo a frame rate or size step, the size first.
+ */
+class rate_controller
+{
+public:
+    rate_controller(int max_bitrate, int max_fps);
+
+    // true if the settings changed
+    bool update(const link_report &report);
+    const stream_settings & settings() const { return current; }
+
+private:
+    int max_bitrate, min_bitrate;
+    int max_fps, min_fps;
+    int clear_reports = 0;
+    stream_settings current;
+};
+
+#endif // RATECONTROL_H_
@@ -3,46 +3,415 @@
 #include <unordered_map>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <functional>
 #include <cstring>
+#include <mutex>
+#include <atomic>
 
 #include "server.h"
+#include "encoder.h"
+#include "demand.h"
+#include "ratecontrol.h"
+#include "timestamp.h"
 
 using namespace std;
 
-unordered_map<string, tuple<const char*, int, int, vector<float>*, const char*>> table;
+// the rungs of a camera, biggest first: the scale of the frame and the bitrate of its mount in kbit/s
+typedef vector<pair<float, int>> rung_list;
 
-char *
-construct_pipeline(const char * devpath, const char * input_type, int width, int height, float scale)
+unordered_map<string, tuple<const char*, int, int, rung_list*, const char*>> table;
+
+// ingest and mounts run at this rate, a keyframe every second
+const int feed_fps = 10;
+
+// size of a rung of the ladder, kept the same in the ingest pipeline and the mount.
+// I420 needs even sizes, the same rounding apply_rate does
+static void
+rung_size(int width, int height, float scale, int &scaled_width, int &scaled_height)
 {
-    char * output = (char *) malloc(512);
+    scaled_width = (int) (width * scale) & ~1;
+    scaled_height = (int) (height * scale) & ~1;
+}
 
-    int scaled_width = width * scale;
-    int scaled_height = height * scale;
+/*
+ * The one pipeline that reads the camera. It scales the frame down to the
+ * biggest rung and converts it to I420 there, once. Every smaller rung is
+ * scaled from the rung above it, so each extra rung costs a small downscale.
+ * Rung i goes to the intervideo channel channel_prefix + i.
+ *
+ * v4l2src ! videorate ! videoscale ! videoconvert ! tee ! intervideosink
+ *                                                   tee ! videoscale ! tee ! intervideosink
+ *                                                                      tee ! ...
+ */
+string
+construct_ingest(const char * devpath, int width, int height, const rung_list &rungs, const string &channel_prefix)
+{
+    string pipeline = "v4l2src name=camera device=";
+    pipeline += devpath;
+    pipeline += " ! videorate ! video/x-raw, framerate=" + to_string(feed_fps) + "/1";
 
-    if (strcmp(input_type, "I420") != 0)
+    char rung[256];
+    for (int i = 0; i < (int) rungs.size(); i++)
     {
-        snprintf(output, 512, "intervideosrc ! video/x-raw, format=%s, width=%d, height=%d ! videoscale ! videoconvert ! video/x-raw, format=I420, width=%d, height=%d ! rtpvrawpay name=pay0 pt=96", input_type, width, height, scaled_width, scaled_height);
-    }
-    else
-    {
-        snprintf(output, 512, "intervideosrc ! video/x-raw, format=I420, width=%d, height=%d ! videoscale ! video/x-raw, format=I420, width=%d, height=%d ! rtpvrawpay name=pay0 pt=96", width, height, scaled_width, scaled_height);
+        int scaled_width, scaled_height;
+        rung_size(width, height, rungs[i].first, scaled_width, scaled_height);
+        if (i == 0)
+        {
+            snprintf(rung, sizeof(rung), " ! videoscale ! video/x-raw, width=%d, height=%d ! videoconvert ! video/x-raw, format=I420", scaled_width, scaled_height);
+        }
+        else
+        {
+            snprintf(rung, sizeof(rung), " r%d. ! queue max-size-buffers=2 leaky=downstream ! videoscale ! video/x-raw, width=%d, height=%d", i - 1, scaled_width, scaled_height);
+        }
+        pipeline += rung;
+        // a slow client on one rung must not hold up the others
+        snprintf(rung, sizeof(rung), " ! tee name=r%d r%d. ! queue max-size-buffers=2 leaky=downstream ! intervideosink channel=%s%d", i, i, channel_prefix.c_str(), i);
+        pipeline += rung;
     }
+    return pipeline;
+}
 
+// the mount for one rung, everything was scaled and converted by the ingest pipeline
+string
+construct_pipeline(const string &channel, int width, int height, int bitrate)
+{
+    // rate and size are the capsfilters the rate controller turns down
+    char output[512];
+    snprintf(output, 512, "intervideosrc channel=%s ! capsfilter name=rate caps=\"video/x-raw, format=I420, width=%d, height=%d, framerate=%d/1\" ! videoscale ! capsfilter name=size caps=\"video/x-raw, width=%d, height=%d\" ! ",
+             channel.c_str(), width, height, feed_fps, width, height);
+    return output + encoder_rtp(bitrate, feed_fps);
+}
 
-    return output;
+static void
+fill_map()
+{
+    rung_list * zedlist = new rung_list;
+    zedlist->push_back(make_pair(0.25f, 600));
+    zedlist->push_back(make_pair(0.1f, 150));
+    rung_list * usb2list = new rung_list;
+    usb2list->push_back(make_pair(0.25f, 400));
+    usb2list->push_back(make_pair(0.1f, 100));
+    table["ZED"] = make_tuple("5556", 4416, 1242, zedlist, "YUY2");
+    table["USB 2.0 Camera"] = make_tuple("5557", 1920, 1080, usb2list, "YUY2");  
 }
 
 void
 setup_map()
 {
-    vector<float> * zedlist = new vector<float>;
-    zedlist->push_back(0.25f);
-    zedlist->push_back(0.1f);
-    vector<float> * usb2list = new vector<float>;
-    usb2list->push_back(0.25f);
-    usb2list->push_back(0.1f);
-    table["ZED"] = make_tuple("5556", 4416, 1242, zedlist, "YUY2");
-    table["USB 2.0 Camera"] = make_tuple("5557", 1920, 1080, usb2list, "YUY2");  
+    // zed-depth starts servers from more than one thread
+    static once_flag filled;
+    call_once(filled, fill_map);
+}
+
+const char *
+camera_port(const char * devname)
+{
+    setup_map();
+    return table.count(devname) ? get<0>(table.at(devname)) : NULL;
+}
+
+// the capture times the frames of a media bring along go out in its RTP packets
+static void
+carry_media_capture(GstRTSPMediaFactory * factory, GstRTSPMedia * media, gpointer data)
+{
+    GstElement * bin = gst_rtsp_media_get_element(media);
+    GstElement * pay = gst_bin_get_by_name(GST_BIN(bin), "pay0");
+    if (pay != NULL)
+    {
+        carry_capture(pay);
+        gst_object_unref(pay);
+    }
+    gst_object_unref(bin);
+}
+
+GstRTSPMediaFactory *
+add_mount(GstRTSPServer * server, const char * mount, const char * launch, demand * d)
+{
+    GstRTSPMountPoints * mounts = gst_rtsp_server_get_mount_points (server);
+    GstRTSPMediaFactory * factory = gst_rtsp_media_factory_new ();
+    gst_rtsp_media_factory_set_launch (factory, launch);
+    gst_rtsp_media_factory_set_shared (factory, TRUE);
+    if (d != NULL)
+    {
+        watch_factory(factory, d);
+    }
+    g_signal_connect(factory, "media-configure", G_CALLBACK(carry_media_capture), NULL);
+    gst_rtsp_mount_points_add_factory (mounts, mount, factory);
+    g_object_unref (mounts);
+#ifdef DEBUG
+    g_print("%s > %s\n", mount, launch);
+#endif
+    return factory;
+}
+
+/*
+ * A media of a camera mount and the controller that fits it to its link.
+ * Clients of a mount share the media, so the worst of their reports counts.
+ */
+struct rate_media
+{
+    rate_controller control;
+    string path;
+    int width, height;
+    GstRTSPMedia * media = NULL;
+    GstElement * rate = NULL;
+    GstElement * size = NULL;
+    GstElement * encoder = NULL;
+    guint timer = 0;
+    // highest sequence number each receiver reported, a new one means a new report
+    unordered_map<guint, guint> last_reports;
+
+    rate_media(const string &path, int width, int height, int bitrate, int fps) : control(bitrate, fps), path(path), width(width), height(height) {}
+};
+
+static void
+apply_rate(rate_media * r)
+{
+    const stream_settings &settings = r->control.settings();
+    int width = r->width, height = r->height;
+    for (int i = 0; i < settings.step; i++)
+    {
+        width = width * 3 / 4;
+        height = height * 3 / 4;
+    }
+    // I420 needs even sizes
+    width &= ~1;
+    height &= ~1;
+
+    GstCaps * caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "I420",
+                                         "width", G_TYPE_INT, r->width, "height", G_TYPE_INT, r->height,
+                                         "framerate", GST_TYPE_FRACTION, settings.fps, 1, NULL);
+    g_object_set(G_OBJECT(r->rate), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+    g_object_set(G_OBJECT(r->size), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    set_encoder_bitrate(r->encoder, probe_encoder(), settings.bitrate);
+    g_print("%s > %d kbit/s, %d fps, %dx%d\n", r->path.c_str(), settings.bitrate, settings.fps, width, height);
+}
+
+// the worst of the receiver reports that came in since the last look, false if none did
+static bool
+read_reports(rate_media * r, link_report &worst)
+{
+    GstRTSPStream * stream = gst_rtsp_media_get_stream(r->media, 0);
+    if (stream == NULL)
+    {
+        return false;
+    }
+    GObject * session = gst_rtsp_stream_get_rtpsession(stream);
+    if (session == NULL)
+    {
+        return false;
+    }
+    GstStructure * stats;
+    g_object_get(session, "stats", &stats, NULL);
+    g_object_unref(session);
+
+    bool found = false;
+    worst = link_report { 0.0f, 0.0f, 0.0f };
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    GValueArray * sources = (GValueArray *) g_value_get_boxed(gst_structure_get_value(stats, "source-stats"));
+    for (guint i = 0; sources != NULL && i < sources->n_values; i++)
+    {
+        const GstStructure * source = gst_value_get_structure(g_value_array_get_nth(sources, i));
+        gboolean internal = TRUE, have_rb = FALSE;
+        guint ssrc = 0, fraction_lost = 0, jitter = 0, round_trip = 0, highest = 0;
+        gst_structure_get_boolean(source, "internal", &internal);
+        gst_structure_get_boolean(source, "have-rb", &have_rb);
+        if (internal || !have_rb)
+        {
+            continue;
+        }
+        gst_structure_get_uint(source, "ssrc", &ssrc);
+        gst_structure_get_uint(source, "rb-exthighestseq", &highest);
+        if (r->last_reports.count(ssrc) && r->last_reports[ssrc] == highest)
+        {
+            continue;
+        }
+        r->last_reports[ssrc] = highest;
+        gst_structure_get_uint(source, "rb-fractionlost", &fraction_lost);
+        gst_structure_get_uint(source, "rb-jitter", &jitter);
+        gst_structure_get_uint(source, "rb-round-trip", &round_trip);
+
+        // fraction lost is out of 256, jitter in 90 kHz ticks and the round trip in 1/65536 s
+        worst.loss = max(worst.loss, fraction_lost / 256.0f);
+        worst.jitter_ms = max(worst.jitter_ms, jitter / 90.0f);
+        worst.rtt_ms = max(worst.rtt_ms, round_trip * 1000.0f / 65536.0f);
+        found = true;
+    }
+G_GNUC_END_IGNORE_DEPRECATIONS
+    gst_structure_free(stats);
+    return found;
+}
+
+static gboolean
+check_rate(gpointer data)
+{
+    rate_media * r = (rate_media *) data;
+    link_report report;
+    if (read_reports(r, report) && r->control.update(report))
+    {
+        apply_rate(r);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+rate_media_prepared(GstRTSPMedia * media, gpointer data)
+{
+    rate_media * r = (rate_media *) data;
+    GstElement * bin = gst_rtsp_media_get_element(media);
+    r->rate = gst_bin_get_by_name(GST_BIN(bin), "rate");
+    r->size = gst_bin_get_by_name(GST_BIN(bin), "size");
+    r->encoder = gst_bin_get_by_name(GST_BIN(bin), ENCODER_NAME);
+    gst_object_unref(bin);
+    if (r->rate != NULL && r->size != NULL && r->encoder != NULL)
+    {
+        // receivers report every few seconds, looking every second catches each one
+        r->timer = g_timeout_add_seconds(1, check_rate, r);
+    }
+}
+
+static void
+rate_media_unprepared(GstRTSPMedia * media, gpointer data)
+{
+    rate_media * r = (rate_media *) data;
+    if (r->timer != 0)
+    {
+        g_source_remove(r->timer);
+    }
+    if (r->rate != NULL)
+    {
+        gst_object_unref(r->rate);
+    }
+    if (r->size != NULL)
+    {
+        gst_object_unref(r->size);
+    }
+    if (r->encoder != NULL)
+    {
+        gst_object_unref(r->encoder);
+    }
+    delete r;
+}
+
+// what a mount sends when its link is good
+struct rate_mount
+{
+    string path;
+    int width, height, bitrate;
+};
+
+// every media starts at the mount's own settings
+static void
+rate_media_configure(GstRTSPMediaFactory * factory, GstRTSPMedia * media, gpointer data)
+{
+    const rate_mount * mount = (const rate_mount *) data;
+    rate_media * r = new rate_media(mount->path, mount->width, mount->height, mount->bitrate, feed_fps);
+    r->media = media;
+    g_signal_connect(media, "prepared", G_CALLBACK(rate_media_prepared), r);
+    g_signal_connect(media, "unprepared", G_CALLBACK(rate_media_unprepared), r);
+}
+
+// adapts every media of a mount made by construct_pipeline to its receivers
+static void
+watch_rate(GstRTSPMediaFactory * factory, const string &path, int width, int height, int bitrate)
+{
+    rate_mount * mount = new rate_mount { path, width, height, bitrate };
+    g_signal_connect(factory, "media-configure", G_CALLBACK(rate_media_configure), mount);
+}
+
+bool
+add_camera(GstRTSPServer * server, const char * devname, const char * devpath, const char * mount)
+{
+    setup_map();
+    if (table.count(devname) == 0)
+    {
+        g_print("%s@%s > No pipeline found; provide pipeline argument\n", devname, devpath);
+        return false;
+    }
+
+    tuple<const char*, int, int, rung_list*, const char*> item = table.at(devname);
+    // biggest first, every rung is scaled from the one before
+    rung_list rungs = *get<3>(item);
+    sort(rungs.begin(), rungs.end(), greater<pair<float, int>>());
+    string channel_prefix = string(devpath) + "/feed";
+    string input = construct_ingest(devpath, get<1>(item), get<2>(item), rungs, channel_prefix);
+#ifdef DEBUG
+    g_print("%s@%s > %s\n", devname, devpath, input.c_str());
+#endif
+    GstElement * inputpipe = gst_parse_launch(input.c_str(), NULL);
+    // READY opens the device without streaming, to know now if it's there
+    if (inputpipe == NULL || gst_element_set_state(inputpipe, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+    {
+        g_print("%s@%s > Couldn't open the camera\n", devname, devpath);
+        if (inputpipe != NULL)
+        {
+            gst_element_set_state(inputpipe, GST_STATE_NULL);
+            gst_object_unref(inputpipe);
+        }
+        return false;
+    }
+    gst_element_set_state(inputpipe, GST_STATE_NULL);
+    GstElement * camera = gst_bin_get_by_name(GST_BIN(inputpipe), "camera");
+    stamp_capture(camera);
+    gst_object_unref(camera);
+    g_print("%s@%s > Opened camera successfully, reading it once someone watches\n", devname, devpath);
+
+    // the camera is only read while one of its mounts has clients
+    demand * ingest = new demand;
+    string name = string(devname) + "@" + devpath;
+    ingest->start = [inputpipe, name]()
+    {
+        g_print("%s > Reading the camera\n", name.c_str());
+        if (gst_element_set_state(inputpipe, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+        {
+            g_print("%s > Couldn't start the camera\n", name.c_str());
+        }
+    };
+    ingest->stop = [inputpipe, name]()
+    {
+        g_print("%s > Nobody watching, camera idle\n", name.c_str());
+        gst_element_set_state(inputpipe, GST_STATE_NULL);
+    };
+
+    gchar * service = gst_rtsp_server_get_service(server);
+    for (int i = 0; i < (int) rungs.size(); i++)
+    {
+        int scaled_width, scaled_height;
+        rung_size(get<1>(item), get<2>(item), rungs[i].first, scaled_width, scaled_height);
+        string pipeline = construct_pipeline(channel_prefix + to_string(i), scaled_width, scaled_height, rungs[i].second);
+        string attachment = string(mount) + "/feed" + to_string(i);
+        GstRTSPMediaFactory * factory = add_mount(server, attachment.c_str(), pipeline.c_str(), ingest);
+        watch_rate(factory, attachment, scaled_width, scaled_height, rungs[i].second);
+        g_print("%s@%s: stream ready at rtsp://127.0.0.1:%s%s\n", devname, devpath, service, attachment.c_str());
+    }
+    g_free(service);
+    return true;
+}
+
+// one per port start_server serves a given pipeline on
+static mutex watched_lock;
+static unordered_map<string, atomic<bool>*> watched_ports;
+
+static atomic<bool> *
+watched_flag(const char * port)
+{
+    lock_guard<mutex> guard(watched_lock);
+    atomic<bool> *& flag = watched_ports[port];
+    if (flag == NULL)
+    {
+        flag = new atomic<bool>(false);
+    }
+    return flag;
+}
+
+bool
+watched(const char * port)
+{
+    return *watched_flag(port);
 }
 
 int 
@@ -50,57 +419,35 @@ start_server (int argc, char *argv[])
 {
     GMainLoop *loop;
     GstRTSPServer *server;
-    const char * devname;
-    const char * devpath;
-    const char * port;
-    vector<char *> pipelines;
-    setup_map();
     gst_init(&argc, &argv);
 
+    /* create a server instance */
+    server = gst_rtsp_server_new ();
+
     if (argc == 3)  // Want to run a predefined camera which is at defined path
     {
-        devname = argv[1];
-        devpath = argv[2];
-        if (table.count(devname) == 0)
+        const char * port = camera_port(argv[1]);
+        if (port == NULL)
         {
-            g_print("%s@%s > No pipeline found; provide pipeline argument\n", devname, devpath);
+            g_print("%s@%s > No pipeline found; provide pipeline argument\n", argv[1], argv[2]);
             return -1;
         }
-        else
+        g_object_set (server, "service", port, NULL);
+        if (!add_camera(server, argv[1], argv[2], ""))
         {
-            string input = "v4l2src device=";
-            input += devpath;
-            input += " ! videorate ! video/x-raw, framerate=10/1 ! intervideosink";
-            GstElement * inputpipe = gst_parse_launch(input.c_str(), NULL);
-            int ret = gst_element_set_state(inputpipe, GST_STATE_PLAYING);
-
-            if (ret == GST_STATE_CHANGE_FAILURE)
-            {
-                exit(-1);
-            }
-            else
-            {
-                g_print("%s@%s > Opened camera successfully\n", devname, devpath);
-            }
-
-            tuple<const char*, int, int, vector<float>*, const char*> item = table.at(devname);
-            for (int i = 0; i < (int) get<3>(item)->size(); i++)
-            {
-                pipelines.push_back(construct_pipeline(devpath, get<4>(item), get<1>(item), get<2>(item), (*(get<3>(item)))[i]));
-#ifdef DEBUG
-                g_print("%s@%s > %s\n", devname, devpath, pipelines[i]);
-#endif
-            }
-      
-            port = get<0>(item);
+            exit(-1);
         }
     } 
     else if (argc == 5) // Likely from command line where everything is defined as an argument
     { 
-        devname = argv[1];
-        devpath = argv[2];
-        port = argv[3];
-        pipelines.push_back(argv[4]);
+        g_object_set (server, "service", argv[3], NULL);
+        // whoever feeds the pipeline asks watched() before making frames for it
+        demand * feed = new demand;
+        atomic<bool> * flag = watched_flag(argv[3]);
+        feed->start = [flag]() { *flag = true; };
+        feed->stop = [flag]() { *flag = false; };
+        add_mount(server, "/feed0", argv[4], feed);
+        g_print ("%s@%s: stream ready at rtsp://127.0.0.1:%s/feed0\n", argv[1], argv[2], argv[3]);
     }
     else
     {
@@ -110,28 +457,6 @@ start_server (int argc, char *argv[])
 
     loop = g_main_loop_new (NULL, FALSE);
 
-    /* create a server instance */
-    server = gst_rtsp_server_new ();
-    g_object_set (server, "service", port, NULL);
-
-    /* get the mount points for this server, every server has a default object
-     * that be used to map uri mount points to media factories */
-    GstRTSPMountPoints * mounts = gst_rtsp_server_get_mount_points (server);
-    char attachment[32];
-
-    for (unsigned short i = 0; i < (int) pipelines.size(); i++)
-    {  
-        GstRTSPMediaFactory * factory = gst_rtsp_media_factory_new ();
-        gst_rtsp_media_factory_set_launch (factory, pipelines[i]);
-        gst_rtsp_media_factory_set_shared (factory, TRUE);
-        snprintf(attachment, 10, "/feed%hu", i); 
-        gst_rtsp_mount_points_add_factory (mounts, attachment, factory);
-        g_print ("%s@%s: stream ready at rtsp://127.0.0.1:%s/feed%d\n", devname, devpath, port, i);
-    }
-  
-    /* don't need the ref to the mapper anymore */
-    g_object_unref (mounts);
-
     /* attach the server to the default maincontext */
     gst_rtsp_server_attach (server, NULL);
 
@@ -2,6 +2,9 @@
 #define SERVER_H_
 
 #include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+#include "demand.h"
 
 struct g_server_data
 {
@@ -9,6 +12,27 @@ struct g_server_data
     const char *argv[8];
 };
 
+// one camera in its own server, see server-wrapper
 int start_server (int argc, char *argv[]);
 
+/*
+ * Whether the pipeline start_server serves on port has clients, or had
+ * them less than standby_seconds ago. Whoever makes its frames can skip
+ * them while it is false.
+ */
+bool watched (const char * port);
+
+// the port start_server serves a camera of the table on, NULL for other cameras
+const char * camera_port (const char * devname);
+
+// serves launch at mount, shared by every client of the mount. d, if given, runs while it has clients
+GstRTSPMediaFactory * add_mount (GstRTSPServer * server, const char * mount, const char * launch, demand * d = NULL);
+
+/*
+ * Serves each size of a camera of the table at mount/feed<n>, biggest first.
+ * The camera is only read while someone watches one of them. false if the
+ * camera isn't in the table or doesn't open.
+ */
+bool add_camera (GstRTSPServer * server, const char * devname, const char * devpath, const char * mount);
+
 #endif // SERVER_H_
@@ -0,0 +1,135 @@
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include "timestamp.h"
+
+static GstCaps *
+capture_caps ()
+{
+    static GstCaps * caps = gst_caps_from_string(CAPTURE_CAPS);
+    return caps;
+}
+
+guint64
+wall_clock_ns ()
+{
+    return (guint64) g_get_real_time() * 1000;
+}
+
+static GstPadProbeReturn
+stamp_buffer (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+    GstBuffer * buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    gst_buffer_add_reference_timestamp_meta(buffer, capture_caps(), wall_clock_ns(), GST_CLOCK_TIME_NONE);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    return GST_PAD_PROBE_OK;
+}
+
+void
+stamp_capture (GstElement * element)
+{
+    GstPad * pad = gst_element_get_static_pad(element, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, stamp_buffer, NULL, NULL);
+    gst_object_unref(pad);
+}
+
+/*
+ * The capture time of the frame the payloader is working on. Its sink and
+ * src pads run in the same thread, a frame goes in and its packets come out
+ * before the next frame.
+ */
+struct carried_capture
+{
+    guint64 capture_ns = 0;
+};
+
+static GstPadProbeReturn
+take_capture (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+    GstReferenceTimestampMeta * meta = gst_buffer_get_reference_timestamp_meta(GST_PAD_PROBE_INFO_BUFFER(info), capture_caps());
+    ((carried_capture *) data)->capture_ns = meta != NULL ? meta->timestamp : 0;
+    return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+write_capture (GstBuffer ** buffer, guint idx, gpointer data)
+{
+    guint64 capture_ns = ((carried_capture *) data)->capture_ns;
+    *buffer = gst_buffer_make_writable(*buffer);
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    if (gst_rtp_buffer_map(*buffer, GST_MAP_READWRITE, &rtp))
+    {
+        guint8 bytes[8];
+        for (int i = 0; i < 8; i++)
+        {
+            bytes[i] = (guint8) (capture_ns >> (56 - 8 * i));
+        }
+        gst_rtp_buffer_add_extension_onebyte_header(&rtp, CAPTURE_EXT_ID, bytes, sizeof(bytes));
+        gst_rtp_buffer_unmap(&rtp);
+    }
+    return TRUE;
+}
+
+static GstPadProbeReturn
+give_capture (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+    if (((carried_capture *) data)->capture_ns == 0)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        GstBufferList * list = gst_buffer_list_make_writable(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+        gst_buffer_list_foreach(list, write_capture, data);
+        GST_PAD_PROBE_INFO_DATA(info) = list;
+    }
+    else
+    {
+        GstBuffer * buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        write_capture(&buffer, 0, data);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+free_capture (gpointer data)
+{
+    delete (carried_capture *) data;
+}
+
+void
+carry_capture (GstElement * payloader)
+{
+    carried_capture * capture = new carried_capture;
+    GstPad * sink = gst_element_get_static_pad(payloader, "sink");
+    GstPad * src = gst_element_get_static_pad(payloader, "src");
+    gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER, take_capture, capture, NULL);
+    // the src probe goes last, it frees what both share
+    gst_pad_add_probe(src, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST), give_capture, capture, free_capture);
+    gst_object_unref(sink);
+    gst_object_unref(src);
+}
+
+bool
+read_capture (GstBuffer * buffer, guint64 &capture_ns)
+{
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+    {
+        return false;
+    }
+    gpointer data;
+    guint size;
+    bool found = gst_rtp_buffer_get_extension_onebyte_header(&rtp, CAPTURE_EXT_ID, 0, &data, &size) && size == 8;
+    if (found)
+    {
+        const guint8 * bytes = (const guint8 *) data;
+        capture_ns = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            capture_ns = (capture_ns << 8) | bytes[i];
+        }
+    }
+    gst_rtp_buffer_unmap(&rtp);
+    return found;
+}
@@ -0,0 +1,27 @@
+#ifndef TIMESTAMP_H_   /* Include guard */
+#define TIMESTAMP_H_
+
+#include <gst/gst.h>
+
+/*
+ * Capture times ride along with the frames as a GstReferenceTimestampMeta of
+ * CAPTURE_CAPS, in nanoseconds of the Unix wall clock. The payloader copies
+ * them into an RFC 8285 one-byte RTP header extension, 8 bytes big-endian.
+ * Comparing them with the receiver's clock gives the age of a frame.
+ */
+#define CAPTURE_CAPS "timestamp/x-unix"
+#define CAPTURE_EXT_ID 7
+
+// stamps every buffer leaving element's src pad with the time it left
+void stamp_capture (GstElement * element);
+
+// writes the capture time of each frame into the RTP packets payloader sends
+void carry_capture (GstElement * payloader);
+
+// the capture time in an RTP packet, false if it has none
+bool read_capture (GstBuffer * rtp, guint64 &capture_ns);
+
+// now on the Unix wall clock, in nanoseconds
+guint64 wall_clock_ns ();
+
+#endif // TIMESTAMP_H_
@@ -0,0 +1,302 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+/*
+ * ./udp-relay [loss %] [delay ms] [listen port] [server host:port]
+ *
+ * A bad radio link on localhost, to try the rate control without the rover.
+ * Clients connect to the relay instead of the server:
+ *
+ *   ./udp-relay 10 50 8555 127.0.0.1:8554
+ *   gst-launch-1.0 rtspsrc location=rtsp://127.0.0.1:8555/feed0 protocols=udp ! decodebin ! autovideosink
+ *
+ * It passes the RTSP conversation through and swaps the client's RTP ports in
+ * SETUP for its own, so the media comes through it. It drops loss % of the
+ * RTP packets and holds every packet back delay ms. The client's receiver
+ * reports go straight to the server.
+ */
+
+// the RTP and RTCP ports the relay took for one stream of the client
+struct stream_relay
+{
+    int rtp = -1, rtcp = -1;
+    int relay_port;
+    int client_port;
+};
+
+struct held_packet
+{
+    chrono::steady_clock::time_point due;
+    int sock;
+    sockaddr_in to;
+    vector<char> data;
+};
+
+static int
+listen_tcp(int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 1) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int
+connect_tcp(const string &address)
+{
+    string host = address, port = "8554";
+    size_t colon = host.rfind(':');
+    if (colon != string::npos)
+    {
+        port = host.substr(colon + 1);
+        host = host.substr(0, colon);
+    }
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+    {
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(sock, result->ai_addr, result->ai_addrlen) < 0)
+    {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(result);
+    return sock;
+}
+
+static int
+bind_udp(int port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// an even port and the one above it, RTP wants the pair
+static bool
+open_pair(stream_relay &s)
+{
+    for (int port = 40000; port < 60000; port += 2)
+    {
+        s.rtp = bind_udp(port);
+        if (s.rtp < 0)
+        {
+            continue;
+        }
+        s.rtcp = bind_udp(port + 1);
+        if (s.rtcp >= 0)
+        {
+            s.relay_port = port;
+            return true;
+        }
+        close(s.rtp);
+    }
+    return false;
+}
+
+/*
+ * Replaces every client_port=a-b with the ports from swap, opening relay ports
+ * the first time a client port is seen. RTSP messages are a few hundred bytes
+ * and come in one read, so a header is never split between two.
+ */
+static string
+swap_ports(const string &message, vector<stream_relay> &streams, bool to_server)
+{
+    static const string key = "client_port=";
+    string out;
+    size_t at = 0;
+    for (size_t found; (found = message.find(key, at)) != string::npos; )
+    {
+        size_t start = found + key.size();
+        int port = atoi(message.c_str() + start);
+        size_t end = message.find_first_not_of("0123456789-", start);
+        out += message.substr(at, start - at);
+        at = end == string::npos ? message.size() : end;
+
+        stream_relay * stream = NULL;
+        for (stream_relay &s : streams)
+        {
+            if ((to_server ? s.client_port : s.relay_port) == port)
+            {
+                stream = &s;
+            }
+        }
+        if (stream == NULL && to_server)
+        {
+            stream_relay s;
+            s.client_port = port;
+            if (open_pair(s))
+            {
+                streams.push_back(s);
+                stream = &streams.back();
+                printf("relaying client ports %d-%d through %d-%d\n", port, port + 1, s.relay_port, s.relay_port + 1);
+            }
+        }
+        int swapped = stream == NULL ? port : to_server ? stream->relay_port : stream->client_port;
+        out += to_string(swapped) + "-" + to_string(swapped + 1);
+    }
+    return out + message.substr(at);
+}
+
+int
+main(int argc, char *argv[])
+{
+    float loss = argc > 1 ? atof(argv[1]) / 100.0f : 0.1f;
+    int delay_ms = argc > 2 ? atoi(argv[2]) : 0;
+    int listen_port = argc > 3 ? atoi(argv[3]) : 8555;
+    string server = argc > 4 ? argv[4] : "127.0.0.1:8554";
+
+    int listener = listen_tcp(listen_port);
+    if (listener < 0)
+    {
+        printf("can't listen on port %d\n", listen_port);
+        return 1;
+    }
+    printf("relaying rtsp://127.0.0.1:%d to %s, dropping %.0f%% and holding %d ms\n", listen_port, server.c_str(), loss * 100, delay_ms);
+
+    mt19937 random(random_device{}());
+    uniform_real_distribution<float> chance(0.0f, 1.0f);
+    while (true)
+    {
+        sockaddr_in client_addr;
+        socklen_t len = sizeof(client_addr);
+        int client = accept(listener, (sockaddr *) &client_addr, &len);
+        if (client < 0)
+        {
+            continue;
+        }
+        int upstream = connect_tcp(server);
+        if (upstream < 0)
+        {
+            printf("can't reach %s\n", server.c_str());
+            close(client);
+            continue;
+        }
+        printf("client connected\n");
+
+        vector<stream_relay> streams;
+        deque<held_packet> held;
+        long relayed = 0, dropped = 0;
+        bool open = true;
+        char buffer[65536];
+        while (open)
+        {
+            vector<pollfd> fds = { { client, POLLIN, 0 }, { upstream, POLLIN, 0 } };
+            for (const stream_relay &s : streams)
+            {
+                fds.push_back({ s.rtp, POLLIN, 0 });
+                fds.push_back({ s.rtcp, POLLIN, 0 });
+            }
+            int timeout = -1;
+            if (!held.empty())
+            {
+                timeout = max(0, (int) chrono::duration_cast<chrono::milliseconds>(held.front().due - chrono::steady_clock::now()).count());
+            }
+            poll(fds.data(), fds.size(), timeout);
+
+            // the RTSP conversation, with the client ports swapped on the way
+            for (int i = 0; i < 2; i++)
+            {
+                if (!(fds[i].revents & (POLLIN | POLLHUP)))
+                {
+                    continue;
+                }
+                ssize_t n = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+                if (n <= 0)
+                {
+                    open = false;
+                    break;
+                }
+                string message = swap_ports(string(buffer, n), streams, i == 0);
+                send(i == 0 ? upstream : client, message.data(), message.size(), MSG_NOSIGNAL);
+            }
+
+            // media from the server, RTP through the bad link and RTCP as it is
+            for (size_t i = 2; open && i < fds.size(); i++)
+            {
+                if (!(fds[i].revents & POLLIN))
+                {
+                    continue;
+                }
+                const stream_relay &s = streams[(i - 2) / 2];
+                bool rtp = fds[i].fd == s.rtp;
+                ssize_t n = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+                if (n <= 0)
+                {
+                    continue;
+                }
+                if (rtp && chance(random) < loss)
+                {
+                    dropped++;
+                    continue;
+                }
+                held_packet p;
+                p.due = chrono::steady_clock::now() + chrono::milliseconds(delay_ms);
+                p.sock = fds[i].fd;
+                p.to = client_addr;
+                p.to.sin_port = htons(rtp ? s.client_port : s.client_port + 1);
+                p.data.assign(buffer, buffer + n);
+                held.push_back(p);
+                relayed += rtp;
+            }
+
+            // the delay is the same for every packet, so they come due in order
+            auto now = chrono::steady_clock::now();
+            while (!held.empty() && held.front().due <= now)
+            {
+                const held_packet &p = held.front();
+                sendto(p.sock, p.data.data(), p.data.size(), 0, (const sockaddr *) &p.to, sizeof(p.to));
+                held.pop_front();
+            }
+        }
+
+        printf("client gone, %ld RTP packets relayed and %ld dropped\n", relayed, dropped);
+        for (const stream_relay &s : streams)
+        {
+            close(s.rtp);
+            close(s.rtcp);
+        }
+        close(client);
+        close(upstream);
+    }
+    return 0;
+}
@@ -15,6 +15,13 @@ void RoverPathfinding::Map::AddObstacle(point coord1, point coord2)
     obstacles.push_back(o);
 }
 
+void RoverPathfinding::Map::AddObstacles(const std::vector<std::pair<point, point> > &segments)
+{
+    obstacles.reserve(obstacles.size() + segments.size());
+    for(auto &s : segments)
+	AddObstacle(s.first, s.second);
+}
+
 
 float deg_to_rad(float deg)
 {
@@ -30,6 +30,7 @@ namespace RoverPathfinding
     public:
 	Map() { nodes.resize(2); } //Allocates space for initial and target node
 	void AddObstacle(std::pair<float, float> coord1, std::pair<float, float> coord2); //Adds an obstacle to the map. Obstacle is specified with 2 points
+	void AddObstacles(const std::vector<std::pair<point, point> > &segments); //Adds a batch of obstacles, e.g. everything the camera saw in one frame
 	std::vector<std::pair<float, float> > ShortestPathTo(float cur_lat, float cur_lng,
 							     float tar_lat, float tar_lng); //Returns a std::vector of lat/lng pairs that specifies the shortest path to the target destination
     private:
@@ -0,0 +1,177 @@
+#include "ObstacleFeed.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define FEED_MAGIC 0x4f425354 // "OBST"
+#define FEED_R_EARTH 6371008.8f // in m
+#define FEED_PI 3.14159265359f
+#define FEED_MERGE_METERS 0.5f // obstacles whose ends are this close are the same obstacle
+#define FEED_MAX_TRIES 1000 // copies Read tries before it takes the feed for stale, a frame takes the writer microseconds
+#define FEED_FORGET_METERS 30.0f // obstacles this far from the rover are out of camera range and no longer checked for repeats
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the sequence counter is shared between processes");
+
+namespace RoverPathfinding
+{
+    //Layout of the shared memory. seq is odd while the writer is filling in frame
+    struct ObstacleFeedShared
+    {
+	uint32_t magic;
+	std::atomic<uint32_t> seq;
+	ObstacleFrame frame;
+    };
+}
+
+static RoverPathfinding::ObstacleFeedShared *map_feed(const char *name, bool writer)
+{
+    int fd = shm_open(name, writer ? (O_CREAT | O_RDWR) : O_RDONLY, 0666);
+    if(fd < 0)
+	return(nullptr);
+    size_t size = sizeof(RoverPathfinding::ObstacleFeedShared);
+    if(writer && ftruncate(fd, size) != 0)
+    {
+	close(fd);
+	return(nullptr);
+    }
+    void *mem = mmap(nullptr, size, writer ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); //The mapping keeps the memory alive
+    if(mem == MAP_FAILED)
+	return(nullptr);
+    return(static_cast<RoverPathfinding::ObstacleFeedShared *>(mem));
+}
+
+RoverPathfinding::ObstacleFeedWriter::~ObstacleFeedWriter()
+{
+    if(shared)
+	munmap(shared, sizeof(ObstacleFeedShared));
+}
+
+bool RoverPathfinding::ObstacleFeedWriter::Open(const char *name)
+{
+    shared = map_feed(name, true);
+    if(!shared)
+	return(false);
+    if(shared->magic != FEED_MAGIC)
+    {
+	shared->magic = FEED_MAGIC;
+	shared->seq.store(0);
+	shared->frame = {};
+    }
+    return(true);
+}
+
+RoverPathfinding::ObstacleFrame *RoverPathfinding::ObstacleFeedWriter::Begin()
+{
+    shared->seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return(&shared->frame);
+}
+
+void RoverPathfinding::ObstacleFeedWriter::Commit()
+{
+    if(shared->frame.count > OBSTACLE_FEED_MAX)
+	shared->frame.count = OBSTACLE_FEED_MAX;
+    shared->frame.frame++;
+    shared->seq.fetch_add(1, std::memory_order_release);
+}
+
+RoverPathfinding::ObstacleFeedReader::~ObstacleFeedReader()
+{
+    if(shared)
+	munmap(shared, sizeof(ObstacleFeedShared));
+}
+
+bool RoverPathfinding::ObstacleFeedReader::Open(const char *name)
+{
+    shared = map_feed(name, false);
+    return(shared != nullptr);
+}
+
+bool RoverPathfinding::ObstacleFeedReader::Read(ObstacleFrame &frame)
+{
+    if(!shared || shared->magic != FEED_MAGIC)
+	return(false);
+
+    //Copy until the writer did not touch the frame while we were copying. A writer
+    //that died halfway leaves seq odd for good, so give up and call the feed stale
+    uint32_t before, after;
+    int tries = 0;
+    do
+    {
+	if(tries++ == FEED_MAX_TRIES)
+	    return(false);
+	before = shared->seq.load(std::memory_order_acquire);
+	if(before & 1)
+	    continue;
+	memcpy(&frame, &shared->frame, sizeof(ObstacleFrame));
+	std::atomic_thread_fence(std::memory_order_acquire);
+	after = shared->seq.load(std::memory_order_relaxed);
+    } while((before & 1) || before != after);
+
+    if(frame.frame == last_frame)
+	return(false);
+    last_frame = frame.frame;
+    return(true);
+}
+
+//Obstacles are at most a few meters away, so the earth is flat enough here
+RoverPathfinding::point RoverPathfinding::ObstacleFeedReader::camera_to_world(float lat, float lng, float heading, float x, float z)
+{
+    float h = heading * FEED_PI / 180.0f;
+    float north = z * cos(h) - x * sin(h);
+    float east = z * sin(h) + x * cos(h);
+    float dlat = north / FEED_R_EARTH * 180.0f / FEED_PI;
+    float dlng = east / (FEED_R_EARTH * cos(lat * FEED_PI / 180.0f)) * 180.0f / FEED_PI;
+    return(std::make_pair(lat + dlat, lng + dlng));
+}
+
+bool RoverPathfinding::ObstacleFeedReader::already_added(point p, point q)
+{
+    //Degrees of latitude per meter, longitude is close enough at these distances
+    float R = FEED_MERGE_METERS / FEED_R_EARTH * 180.0f / FEED_PI;
+    auto close = [R](point a, point b) {
+	return((a.first - b.first) * (a.first - b.first) + (a.second - b.second) * (a.second - b.second) <= R * R);
+    };
+    for(auto &o : added)
+    {
+	if((close(o.first, p) && close(o.second, q)) || (close(o.first, q) && close(o.second, p)))
+	    return(true);
+    }
+    return(false);
+}
+
+int RoverPathfinding::ObstacleFeedReader::Poll(Map &map, float lat, float lng, float heading)
+{
+    ObstacleFrame frame;
+    if(!Read(frame))
+	return(0);
+
+    //Drop obstacles the camera can no longer see so added stays small
+    float F = FEED_FORGET_METERS / FEED_R_EARTH * 180.0f / FEED_PI;
+    point rover = std::make_pair(lat, lng);
+    auto far = [F, rover](const std::pair<point, point> &o) {
+	float dlat = o.first.first - rover.first;
+	float dlng = o.first.second - rover.second;
+	return(dlat * dlat + dlng * dlng > F * F);
+    };
+    added.erase(std::remove_if(added.begin(), added.end(), far), added.end());
+
+    std::vector<std::pair<point, point> > batch;
+    for(uint32_t i = 0; i < frame.count; i++)
+    {
+	const ObstacleRecord &r = frame.records[i];
+	point p = camera_to_world(lat, lng, heading, r.x_left, r.depth);
+	point q = camera_to_world(lat, lng, heading, r.x_right, r.depth);
+	if(already_added(p, q))
+	    continue;
+	added.push_back(std::make_pair(p, q));
+	batch.push_back(std::make_pair(p, q));
+    }
+    map.AddObstacles(batch);
+    return(batch.size());
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include "Map.h"
+
+#define OBSTACLE_FEED_NAME "/rover_obstacles" //POSIX shared memory object zed-depth publishes to
+#define OBSTACLE_FEED_MAX 64 //Most obstacles in one frame
+
+namespace RoverPathfinding
+{
+    //One obstacle in the camera frame. x is meters to the right of the camera center,
+    //depth is meters straight ahead.
+    struct ObstacleRecord
+    {
+	float x_left;
+	float x_right;
+	float depth;
+	int32_t id; //Obstacle id from zed-depth, stays the same while the obstacle is tracked
+    };
+
+    //All obstacles seen in one camera frame
+    struct ObstacleFrame
+    {
+	uint64_t timestamp_ns; //Capture time of the camera frame
+	uint32_t frame; //Goes up by one for every published frame
+	uint32_t count; //Records in use
+	ObstacleRecord records[OBSTACLE_FEED_MAX];
+    };
+
+    struct ObstacleFeedShared;
+
+    //Publishes the newest frame into shared memory. There is a single slot guarded by a
+    //sequence counter, so readers always get the latest frame and nobody ever blocks.
+    class ObstacleFeedWriter
+    {
+    public:
+	ObstacleFeedWriter() : shared(nullptr) {}
+	~ObstacleFeedWriter();
+	bool Open(const char *name = OBSTACLE_FEED_NAME); //Creates the shared memory if needed. Returns false on failure
+	ObstacleFrame *Begin(); //Returns the shared frame to fill in place. Readers retry until Commit
+	void Commit(); //Publishes the frame filled since Begin
+    private:
+	ObstacleFeedShared *shared;
+    };
+
+    //Reads frames from zed-depth and turns them into obstacles on the Map
+    class ObstacleFeedReader
+    {
+    public:
+	ObstacleFeedReader() : shared(nullptr), last_frame(0) {}
+	~ObstacleFeedReader();
+	bool Open(const char *name = OBSTACLE_FEED_NAME); //Returns false if zed-depth has not created the feed yet
+	bool Read(ObstacleFrame &frame); //Copies out the newest frame. Returns false if there is no frame newer than the last one read, or the writer died while publishing one
+	int Poll(Map &map, float lat, float lng, float heading); //Reads the newest frame and adds its obstacles to map as one batch, placed around a rover at lat/lng facing heading (degrees, 0.0 is N). Returns the number of obstacles added
+    private:
+	point camera_to_world(float lat, float lng, float heading, float x, float z); //Returns the lat/lng of a point x meters right and z meters ahead of the rover
+	bool already_added(point p, point q); //Tells whether an obstacle with both ends within FEED_MERGE_METERS of p and q was added before
+
+	ObstacleFeedShared *shared;
+	uint32_t last_frame;
+	std::vector<std::pair<point, point> > added; //Obstacles added to the map that are still within FEED_FORGET_METERS of the rover
+    };
+}
@@ -0,0 +1,51 @@
+#include <iostream>
+#include "Map.h"
+#include "Map.cpp"
+#include "ObstacleFeed.cpp"
+
+int main(void)
+{
+    RoverPathfinding::ObstacleFeedWriter writer;
+    RoverPathfinding::ObstacleFeedReader reader;
+    if(!writer.Open("/rover_obstacles_test") || !reader.Open("/rover_obstacles_test"))
+    {
+	std::cout << "Failed to open the feed" << std::endl;
+	return(1);
+    }
+
+    //A 2 m wide obstacle 3 m ahead, seen in two frames in a row. Only the first frame adds it
+    RoverPathfinding::Map m;
+    const int expected[] = {1, 0};
+    bool ok = true;
+    for(int i = 0; i < 2; i++)
+    {
+	RoverPathfinding::ObstacleFrame *frame = writer.Begin();
+	frame->timestamp_ns = i;
+	frame->count = 1;
+	frame->records[0].x_left = -1.0f;
+	frame->records[0].x_right = 1.0f;
+	frame->records[0].depth = 3.0f;
+	frame->records[0].id = 1;
+	writer.Commit();
+	int n = reader.Poll(m, 47.6536f, -122.3080f, 0.0f);
+	std::cout << "Frame " << i << ": added " << n << " obstacles, expected " << expected[i] << std::endl;
+	ok = ok && n == expected[i];
+    }
+    int n = reader.Poll(m, 47.6536f, -122.3080f, 0.0f);
+    std::cout << "Nothing new: added " << n << " obstacles, expected 0" << std::endl;
+    ok = ok && n == 0;
+
+    //A writer that dies between Begin and Commit must not hang the reader
+    writer.Begin();
+    n = reader.Poll(m, 47.6536f, -122.3080f, 0.0f);
+    std::cout << "Writer died: added " << n << " obstacles, expected 0" << std::endl;
+    ok = ok && n == 0;
+
+    shm_unlink("/rover_obstacles_test");
+    if(!ok)
+    {
+	std::cout << "FAILED" << std::endl;
+	return(1);
+    }
+    return(0);
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "remap.h"
+
+/*
+   Compiles the remap tables written by remapping.java into the binary form
+   loadRemap maps at startup. Every value is checked here once, instead of
+   being clamped on every start.
+
+   compile-remap remap_x.txt remap_y.txt remap.bin
+ */
+int main(int argc, char *argv[])
+{
+  if (argc != 4) {
+    printf("usage: %s remap_x.txt remap_y.txt remap.bin\n", argv[0]);
+    return 1;
+  }
+
+  std::ifstream X(argv[1]);
+  std::ifstream Y(argv[2]);
+  if (!X || !Y) {
+    printf("can't read %s or %s\n", argv[1], argv[2]);
+    return 1;
+  }
+
+  // the tables are square images of the hemisphere, x within a row and y across rows
+  std::vector<std::vector<int> > xs, ys;
+  std::string lineX;
+  std::string lineY;
+  while (std::getline(X, lineX) && std::getline(Y, lineY)) {
+    std::stringstream streamX(lineX);
+    std::stringstream streamY(lineY);
+    std::vector<int> rowX, rowY;
+    int x, y;
+    while (streamX >> x) {
+      rowX.push_back(x);
+    }
+    while (streamY >> y) {
+      rowY.push_back(y);
+    }
+    if (rowX.size() != rowY.size() || (!xs.empty() && rowX.size() != xs[0].size())) {
+      printf("row %zu of the tables has %zu x and %zu y values\n", xs.size(), rowX.size(), rowY.size());
+      return 1;
+    }
+    xs.push_back(rowX);
+    ys.push_back(rowY);
+  }
+  if (xs.empty() || xs[0].empty()) {
+    printf("the tables are empty\n");
+    return 1;
+  }
+
+  remap_header header;
+  header.magic = REMAP_MAGIC;
+  header.version = REMAP_VERSION;
+  header.cols = xs[0].size();
+  header.rows = xs.size();
+  header.reserved = 0;
+
+  // positions point into the straightened hemisphere, which is as big as the table
+  std::vector<int16_t> table;
+  table.reserve(2 * header.cols * header.rows);
+  for (int row = 0; row < header.rows; row++) {
+    for (int col = 0; col < header.cols; col++) {
+      int x = xs[row][col];
+      int y = ys[row][col];
+      if (x < 0 || x >= header.cols || y < 0 || y >= header.rows) {
+        printf("(%d, %d) at row %d col %d is outside the %dx%d hemisphere\n", x, y, row, col, header.cols, header.rows);
+        return 1;
+      }
+      table.push_back(x);
+      table.push_back(y);
+    }
+  }
+
+  // written next to the output and renamed, a running server never sees half a table
+  std::string tmp = std::string(argv[3]) + ".tmp";
+  FILE *out = fopen(tmp.c_str(), "wb");
+  if (!out) {
+    printf("can't write %s\n", tmp.c_str());
+    return 1;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+            && fwrite(table.data(), sizeof(int16_t), table.size(), out) == table.size();
+  ok = fclose(out) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), argv[3]) != 0) {
+    printf("can't write %s\n", argv[3]);
+    remove(tmp.c_str());
+    return 1;
+  }
+  printf("%s: %dx%d, %zu bytes\n", argv[3], header.cols, header.rows, sizeof(header) + table.size() * sizeof(int16_t));
+  return 0;
+}
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <opencv2/imgproc.hpp>
+
+#include "dewarp.h"
+#include "remap.h"
+#include "fisheye.h"
+
+using namespace cv;
+
+Mat coordinates;
+
+/*
+   Splits the provided image into two. Splitting occurs at the middle of width.
+   Returns a pair of Mat objects. First is the left half. Second is right.
+ */
+std::pair<Mat,Mat> split(Mat dualFisheye)
+{	
+  //----------------------------------------------------------------------------------------
+  //DO NOT MESS WITH THESE VALUES UNLESS TOTALLY NECESSARY. THEY HAVE BEEN SELECTED FOR OUR 
+  //PARTICULAR RICOH THETEA S THROUGH EXPERIMENTATION.
+  //----------------------------------------------------------------------------------------
+  cv::Rect roi;
+  roi.x = 15;
+  roi.y = 36;
+  roi.width = dualFisheye.cols / 2 - 48; // ROWS
+  roi.height = dualFisheye.rows - 148;   // COLS
+  //Crop the image using these parameters.
+  Mat left = dualFisheye(roi);
+  //Crop the other half.
+  roi.x = dualFisheye.cols / 2 + 31;
+  roi.y = 44;
+  roi.width = dualFisheye.cols / 2 - 48;
+  roi.height = dualFisheye.rows - 148 ;
+  Mat right = dualFisheye(roi);
+  return std::make_pair(left, right);
+}
+
+/*
+   This will take separated images from the feed of the Ricoh Theta S. It will
+   straighten the images to get the actual top facing up. 
+   Accepts a pair of images. The first is the left feed and second is right feed. 
+ */
+std::pair<Mat, Mat> correctOrientation(std::pair<Mat, Mat> feed)
+{
+  transpose(feed.first, feed.first);
+  flip(feed.first, feed.first, +1);
+  transpose(feed.second, feed.second);
+  flip(feed.second, feed.second, 0);
+  return feed;
+}
+
+/*
+   This will do the transformation from the circular to rectangular field.
+   Will be using the maps stored in the coordinates table.
+ */
+std::pair<Mat, Mat> fisheyeToRect(std::pair<Mat, Mat> feed)
+{
+  Mat leftSq(feed.first.rows, feed.first.cols, CV_8UC3);
+  Mat rightSq(feed.second.rows, feed.second.cols, CV_8UC3);
+  for (int y = 0; y < ROWS; y++) {
+    for (int x = 0; x < COLS; x++) {
+      Vec2s c = coordinates.at<Vec2s>(y, x);
+      leftSq.at<Vec3b>(y, x) = feed.first.at<Vec3b>(c[1], c[0]);
+      rightSq.at<Vec3b>(y, x) = feed.second.at<Vec3b>(c[1], c[0]);
+    }
+  }
+  return std::make_pair(leftSq, rightSq);
+}
+
+/*
+   Will take a feed and will put them together in one Mat object.
+   Will return this new image.
+ */
+Mat stitch(std::pair<Mat, Mat> feed)
+{
+  Mat pano(feed.first.rows, feed.first.cols * 2, CV_8UC3);
+  feed.first.copyTo(pano(Rect(0, 0, feed.first.cols, feed.first.rows)));
+  feed.second.copyTo(pano(Rect(feed.first.cols, 0, feed.second.cols, feed.second.rows)));
+  return pano;
+}
+
+bool loadRemap(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("can't open %s, make compiles it from remap_x.txt and remap_y.txt\n", path.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(remap_header)) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  const remap_header *header = (const remap_header *)data;
+  if (header->magic != REMAP_MAGIC || header->version != REMAP_VERSION
+      || header->cols != COLS || header->rows != ROWS
+      || (size_t)st.st_size != sizeof(remap_header) + header->cols * header->rows * 2 * sizeof(int16_t)) {
+    printf("%s is not a %dx%d remap table\n", path.c_str(), COLS, ROWS);
+    munmap(data, st.st_size);
+    return false;
+  }
+  // stays mapped for as long as the server runs, the pages are shared and read only
+  coordinates = Mat(header->rows, header->cols, CV_16SC2, (uchar *)data + sizeof(remap_header));
+  return true;
+}
+
+std::string remapPath()
+{
+  char exe[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (len <= 0) {
+    return REMAP_FILE;
+  }
+  std::string dir(exe, len);
+  return dir.substr(0, dir.rfind('/') + 1) + REMAP_FILE;
+}
+
+/*
+   Builds the map by running an image through split, correctOrientation,
+   fisheyeToRect and stitch. Every pixel of the image holds its own index in its
+   three channels, so each panorama pixel ends up holding the index of the raw
+   pixel it comes from, and the map can't drift from the steps.
+ */
+Mat panoramaMap(Size frameSize)
+{
+  CV_Assert(frameSize.area() <= (1 << 24));
+  Mat index(frameSize, CV_8UC3);
+  for (int y = 0; y < index.rows; y++) {
+    for (int x = 0; x < index.cols; x++) {
+      int i = y * index.cols + x;
+      index.at<Vec3b>(y, x) = Vec3b(i & 255, (i >> 8) & 255, i >> 16);
+    }
+  }
+
+  Mat pano = stitch(fisheyeToRect(correctOrientation(split(index))));
+  Mat map(pano.size(), CV_16SC2);
+  for (int y = 0; y < pano.rows; y++) {
+    for (int x = 0; x < pano.cols; x++) {
+      Vec3b p = pano.at<Vec3b>(y, x);
+      int i = p[0] | (p[1] << 8) | (p[2] << 16);
+      map.at<Vec2s>(y, x) = Vec2s(i % index.cols, i / index.cols);
+    }
+  }
+  return map;
+}
+
+dewarp_map fixedPointMap(const Mat &map, Size frameSize, bool bilinear)
+{
+  CV_Assert(map.type() == CV_16SC2 || map.type() == CV_32FC2);
+  CV_Assert(frameSize.width >= 2 && frameSize.height >= 2);
+  bilinear = bilinear && map.type() == CV_32FC2;
+
+  dewarp_map fixed;
+  fixed.frameSize = frameSize;
+  fixed.xy.create(map.size(), CV_16SC2);
+  if (bilinear) {
+    fixed.frac.create(map.size(), CV_16UC1);
+  }
+  float maxX = frameSize.width - 1, maxY = frameSize.height - 1;
+  for (int y = 0; y < map.rows; y++) {
+    Vec2s *xy = fixed.xy.ptr<Vec2s>(y);
+    for (int x = 0; x < map.cols; x++) {
+      Point2f p;
+      if (map.type() == CV_32FC2) {
+        p = Point2f(map.at<Vec2f>(y, x));
+      } else {
+        p = Point2f(map.at<Vec2s>(y, x)[0], map.at<Vec2s>(y, x)[1]);
+      }
+      p.x = std::min(std::max(p.x, 0.0f), maxX);
+      p.y = std::min(std::max(p.y, 0.0f), maxY);
+      if (!bilinear) {
+        xy[x] = Vec2s(cvRound(p.x), cvRound(p.y));
+        continue;
+      }
+      // the last row and column have nothing to their right or below, so those
+      // read the pixel before at almost full weight instead
+      int fx = std::min(cvRound(p.x * DEWARP_TAB), (int)(maxX * DEWARP_TAB) - 1);
+      int fy = std::min(cvRound(p.y * DEWARP_TAB), (int)(maxY * DEWARP_TAB) - 1);
+      xy[x] = Vec2s(fx >> DEWARP_BITS, fy >> DEWARP_BITS);
+      fixed.frac.at<ushort>(y, x) = (fy & (DEWARP_TAB - 1)) * DEWARP_TAB + (fx & (DEWARP_TAB - 1));
+    }
+  }
+  return fixed;
+}
+
+template<int cn>
+static void nearestRows(const Mat &src, const dewarp_map &map, Mat &dst, const Range &rows)
+{
+  const uchar *data = src.data;
+  size_t step = src.step;
+  for (int y = rows.start; y < rows.end; y++) {
+    const short *xy = map.xy.ptr<short>(y);
+    uchar *out = dst.ptr<uchar>(y);
+    for (int x = 0; x < dst.cols; x++, out += cn) {
+      const uchar *p = data + xy[2 * x + 1] * step + xy[2 * x] * cn;
+      for (int c = 0; c < cn; c++) {
+        out[c] = p[c];
+      }
+    }
+  }
+}
+
+template<int cn>
+static void bilinearRows(const Mat &src, const dewarp_map &map, Mat &dst, const Range &rows)
+{
+  const uchar *data = src.data;
+  size_t step = src.step;
+  for (int y = rows.start; y < rows.end; y++) {
+    const short *xy = map.xy.ptr<short>(y);
+    const ushort *frac = map.frac.ptr<ushort>(y);
+    uchar *out = dst.ptr<uchar>(y);
+    for (int x = 0; x < dst.cols; x++, out += cn) {
+      const uchar *p = data + xy[2 * x + 1] * step + xy[2 * x] * cn;
+      int fx = frac[x] & (DEWARP_TAB - 1);
+      int fy = frac[x] >> DEWARP_BITS;
+      // weights add up to DEWARP_TAB * DEWARP_TAB
+      int w00 = (DEWARP_TAB - fx) * (DEWARP_TAB - fy);
+      int w01 = fx * (DEWARP_TAB - fy);
+      int w10 = (DEWARP_TAB - fx) * fy;
+      int w11 = fx * fy;
+      for (int c = 0; c < cn; c++) {
+        int sum = p[c] * w00 + p[c + cn] * w01 + p[c + step] * w10 + p[c + step + cn] * w11;
+        out[c] = (sum + (1 << (2 * DEWARP_BITS - 1))) >> (2 * DEWARP_BITS);
+      }
+    }
+  }
+}
+
+template<int cn>
+static void dewarpRows(const Mat &src, const dewarp_map &map, Mat &dst, const Range &rows)
+{
+  if (map.frac.empty()) {
+    nearestRows<cn>(src, map, dst, rows);
+  } else {
+    bilinearRows<cn>(src, map, dst, rows);
+  }
+}
+
+void dewarp(const Mat &dualFisheye, const dewarp_map &map, Mat &pano)
+{
+  CV_Assert((dualFisheye.type() == CV_8UC3 || dualFisheye.type() == CV_8UC1) && dualFisheye.size() == map.frameSize);
+  pano.create(map.xy.size(), dualFisheye.type());
+  // a band of rows covers both hemispheres, and the map and the panorama are
+  // both walked in memory order
+  parallel_for_(Range(0, pano.rows), [&](const Range &rows) {
+    if (dualFisheye.channels() == 3) {
+      dewarpRows<3>(dualFisheye, map, pano, rows);
+    } else {
+      dewarpRows<1>(dualFisheye, map, pano, rows);
+    }
+  }, getNumThreads());
+}
+
+dewarp_map halfMap(const dewarp_map &map)
+{
+  Size half(map.xy.cols / 2, map.xy.rows / 2);
+  Mat positions(half, CV_32FC2);
+  for (int y = 0; y < half.height; y++) {
+    for (int x = 0; x < half.width; x++) {
+      Vec2s xy = map.xy.at<Vec2s>(2 * y, 2 * x);
+      Vec2f p(xy[0], xy[1]);
+      if (!map.frac.empty()) {
+        ushort frac = map.frac.at<ushort>(2 * y, 2 * x);
+        p += Vec2f(frac & (DEWARP_TAB - 1), frac >> DEWARP_BITS) * (1.0f / DEWARP_TAB);
+      }
+      positions.at<Vec2f>(y, x) = p * 0.5f;
+    }
+  }
+  return fixedPointMap(positions, Size(map.frameSize.width / 2, map.frameSize.height / 2), !map.frac.empty());
+}
+
+Size panoramaSize(int width)
+{
+  if (width <= 0) {
+    return Size(2 * COLS, ROWS);
+  }
+  // a multiple of 4 keeps both sides even for the encoder
+  return Size(width & ~3, (width & ~3) / 2);
+}
+
+Size viewSize(const dewarp_view &view)
+{
+  if (view.fov <= 0.0f) {
+    return panoramaSize(view.width);
+  }
+  int width = view.width > 0 ? view.width & ~3 : 640;
+  return Size(width, (width * 3 / 4) & ~1);
+}
+
+bool viewMap(Size frameSize, const dewarp_view &view, dewarp_map &map)
+{
+  if (view.fov <= 0.0f && view.width <= 0) {
+    // the tables were measured on the camera's frames, other sizes would read past them
+    if (frameSize != THETA_FRAME) {
+      return false;
+    }
+    // elements negotiating at the same time would load the table twice
+    static std::mutex remapLock;
+    std::lock_guard<std::mutex> guard(remapLock);
+    if (coordinates.empty() && !loadRemap(remapPath())) {
+      return false;
+    }
+    map = fixedPointMap(panoramaMap(frameSize), frameSize, false);
+    return true;
+  }
+
+  // the lenses are measured in the camera's 1280x720, other sizes are scaled
+  float sx = frameSize.width / (float)THETA_FRAME.width, sy = frameSize.height / (float)THETA_FRAME.height;
+  fisheye_lens left = THETA_LEFT, right = THETA_RIGHT;
+  for (fisheye_lens *lens : { &left, &right }) {
+    lens->cx *= sx;
+    lens->cy *= sy;
+    lens->radius *= sx;
+  }
+  Mat positions;
+  if (view.fov <= 0.0f) {
+    positions = fisheyeMap(left, right, viewSize(view));
+  }
+  else {
+    positions = viewportMap(left, right, view.yaw, view.pitch, view.fov, viewSize(view));
+  }
+  map = fixedPointMap(positions, frameSize, true);
+  return true;
+}
+
+// maps kept around for views nobody watches anymore
+#define DEWARP_CACHE_SIZE 16
+
+struct cached_map
+{
+  std::shared_ptr<const dewarp_map> map;
+  uint64_t used;
+};
+
+static std::mutex cacheLock;
+static std::map<std::string, cached_map> cache;
+static uint64_t cacheClock = 0;
+
+std::shared_ptr<const dewarp_map> cachedViewMap(Size frameSize, const dewarp_view &view, bool half)
+{
+  char key[128];
+  snprintf(key, sizeof(key), "%dx%d %d %.1f %.1f %.1f %d", frameSize.width, frameSize.height,
+           view.width, view.yaw, view.pitch, view.fov, half);
+  {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    auto found = cache.find(key);
+    if (found != cache.end()) {
+      found->second.used = ++cacheClock;
+      return found->second.map;
+    }
+  }
+
+  // built without holding the lock, so a new view doesn't hold up the others.
+  // Two viewers asking for the same new view at once both build it, which is harmless.
+  std::shared_ptr<dewarp_map> map = std::make_shared<dewarp_map>();
+  if (half) {
+    std::shared_ptr<const dewarp_map> full = cachedViewMap(frameSize, view, false);
+    if (!full) {
+      return nullptr;
+    }
+    *map = halfMap(*full);
+  }
+  else if (!viewMap(frameSize, view, *map)) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> guard(cacheLock);
+  if (cache.size() >= DEWARP_CACHE_SIZE) {
+    auto oldest = cache.begin();
+    for (auto i = cache.begin(); i != cache.end(); ++i) {
+      if (i->second.used < oldest->second.used) {
+        oldest = i;
+      }
+    }
+    cache.erase(oldest);
+  }
+  cache[key] = { map, ++cacheClock };
+  return map;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <opencv2/core.hpp>
+
+//Found these through experimentation.
+const int COLS = 572;
+const int ROWS = 592;
+
+// the camera's dual fisheye frame, the only size the remap tables fit
+const cv::Size THETA_FRAME(1280, 720);
+
+// Where each pixel of a dewarped hemisphere comes from, (x, y) pairs as CV_16SC2,
+// ROWS by COLS. It points into the mapped remap table.
+extern cv::Mat coordinates;
+
+/*
+   The dewarp one step at a time. These are the reference for the map below and
+   are not used per frame anymore.
+ */
+std::pair<cv::Mat, cv::Mat> split(cv::Mat dualFisheye);
+std::pair<cv::Mat, cv::Mat> correctOrientation(std::pair<cv::Mat, cv::Mat> feed);
+std::pair<cv::Mat, cv::Mat> fisheyeToRect(std::pair<cv::Mat, cv::Mat> feed);
+cv::Mat stitch(std::pair<cv::Mat, cv::Mat> feed);
+
+/*
+   Maps the table compiled by compile-remap into coordinates. Returns false if
+   it is missing or not a table for COLS by ROWS.
+ */
+bool loadRemap(const std::string &path);
+
+// remap.bin next to the executable, so the server starts from any directory
+std::string remapPath();
+
+/*
+   The four steps above folded into one CV_16SC2 map from the raw dual fisheye
+   frame to the panorama. Needs coordinates to be loaded.
+ */
+cv::Mat panoramaMap(cv::Size frameSize);
+
+// sub-pixel positions of the bilinear map are in 1/DEWARP_TAB of a pixel
+#define DEWARP_BITS 5
+#define DEWARP_TAB (1 << DEWARP_BITS)
+
+/*
+   A map in fixed point, ready for dewarp. xy is the source pixel of every output
+   pixel as CV_16SC2, row after row. For bilinear maps xy is the top left of the
+   four pixels read and frac is the position inside them as y * DEWARP_TAB + x,
+   CV_16UC1. frac is empty for nearest.
+ */
+struct dewarp_map
+{
+  cv::Mat xy;
+  cv::Mat frac;
+  cv::Size frameSize;
+};
+
+/*
+   Converts a CV_16SC2 or CV_32FC2 map of source positions for frames of frameSize.
+   Positions outside the frame are clamped to its edge. Bilinear only applies to
+   float maps, integer positions would read four pixels for the same result.
+ */
+dewarp_map fixedPointMap(const cv::Mat &map, cv::Size frameSize, bool bilinear);
+
+/*
+   Dewarps and stitches one raw frame in a single pass, one read per output pixel
+   or four for bilinear. Takes BGR frames or single planes. Bands of rows run on
+   all cores. pano is reused between calls.
+ */
+void dewarp(const cv::Mat &dualFisheye, const dewarp_map &map, cv::Mat &pano);
+
+// the map at half the size both ways, for the chroma planes of I420
+dewarp_map halfMap(const dewarp_map &map);
+
+/*
+   The panorama the server sends for a width. 0 is the 1144x592 one of the
+   remap tables, any other width gets an equirectangular panorama half as high
+   built from the lens parameters.
+ */
+cv::Size panoramaSize(int width);
+
+/*
+   What gets dewarped of the sphere. fov 0 is the whole panorama at
+   panoramaSize(width). Any other fov is a viewport that many degrees across,
+   yaw degrees right and pitch degrees up of the panorama's center. Viewports
+   are width wide, 640 for 0, and 3/4 of that high.
+ */
+struct dewarp_view
+{
+  int width = 0;
+  float yaw = 0.0f;
+  float pitch = 0.0f;
+  float fov = 0.0f;
+};
+
+cv::Size viewSize(const dewarp_view &view);
+
+// builds the map for a view, false if the remap tables can't be loaded or the
+// panorama of the tables is asked for frames that aren't THETA_FRAME
+bool viewMap(cv::Size frameSize, const dewarp_view &view, dewarp_map &map);
+
+/*
+   The map for a view, built the first time it is asked for and then shared by
+   everyone watching it. half is the halfMap for the chroma planes. The last
+   DEWARP_CACHE_SIZE maps stay cached. NULL if the map can't be built.
+ */
+std::shared_ptr<const dewarp_map> cachedViewMap(cv::Size frameSize, const dewarp_view &view, bool half);
@@ -0,0 +1,86 @@
+#include <math.h>
+#include <algorithm>
+#include <opencv2/core.hpp>
+
+#include "fisheye.h"
+
+using namespace cv;
+
+// a lens turned into vectors, so the map only needs dot products
+struct lens_axes
+{
+  Vec3f axis, right, up;  // where the lens looks, in the panorama's frame
+  Vec2f frameRight, frameUp; // the scene's right and up in the raw frame
+  float pixelsPerRadian;
+  fisheye_lens lens;
+};
+
+static lens_axes lensAxes(const fisheye_lens &lens)
+{
+  float yaw = lens.yaw * CV_PI / 180.0;
+  float rotation = lens.rotation * CV_PI / 180.0;
+  lens_axes axes;
+  axes.axis = Vec3f(sinf(yaw), 0.0f, cosf(yaw));
+  axes.right = Vec3f(cosf(yaw), 0.0f, -sinf(yaw));
+  axes.up = Vec3f(0.0f, 1.0f, 0.0f);
+  // y grows down in the frame, so up is right turned a quarter counterclockwise
+  axes.frameRight = Vec2f(cosf(rotation), sinf(rotation));
+  axes.frameUp = Vec2f(sinf(rotation), -cosf(rotation));
+  axes.pixelsPerRadian = lens.radius / (lens.fov * CV_PI / 360.0);
+  axes.lens = lens;
+  return axes;
+}
+
+// where a direction in the panorama's frame shows up in the raw frame, through the
+// lens whose axis is closest
+static Vec2f project(const lens_axes lenses[2], const Vec3f &dir)
+{
+  const lens_axes &lens = dir.dot(lenses[0].axis) >= dir.dot(lenses[1].axis) ? lenses[0] : lenses[1];
+  float theta = acosf(std::min(std::max(dir.dot(lens.axis), -1.0f), 1.0f));
+  float phi = atan2f(dir.dot(lens.up), dir.dot(lens.right));
+  float r = theta * lens.pixelsPerRadian;
+  Vec2f p = lens.frameRight * (r * cosf(phi)) + lens.frameUp * (r * sinf(phi));
+  return Vec2f(lens.lens.cx + p[0], lens.lens.cy + p[1]);
+}
+
+Mat fisheyeMap(const fisheye_lens &left, const fisheye_lens &right, Size panoSize)
+{
+  const lens_axes lenses[2] = { lensAxes(left), lensAxes(right) };
+  Mat map(panoSize, CV_32FC2);
+  parallel_for_(Range(0, panoSize.height), [&](const Range &rows) {
+    for (int y = rows.start; y < rows.end; y++) {
+      // pixel centers, top row just below straight up, bottom row just above straight down
+      float lat = CV_PI * (0.5 - (y + 0.5) / panoSize.height);
+      float cosLat = cosf(lat), sinLat = sinf(lat);
+      Vec2f *out = map.ptr<Vec2f>(y);
+      for (int x = 0; x < panoSize.width; x++) {
+        float lon = 2.0 * CV_PI * ((x + 0.5) / panoSize.width - 0.5);
+        out[x] = project(lenses, Vec3f(cosLat * sinf(lon), sinLat, cosLat * cosf(lon)));
+      }
+    }
+  });
+  return map;
+}
+
+Mat viewportMap(const fisheye_lens &left, const fisheye_lens &right, float yaw, float pitch, float fov, Size viewSize)
+{
+  const lens_axes lenses[2] = { lensAxes(left), lensAxes(right) };
+  float focal = 0.5f * viewSize.width / tanf(fov * CV_PI / 360.0);
+  float cosYaw = cosf(yaw * CV_PI / 180.0), sinYaw = sinf(yaw * CV_PI / 180.0);
+  float cosPitch = cosf(pitch * CV_PI / 180.0), sinPitch = sinf(pitch * CV_PI / 180.0);
+  Mat map(viewSize, CV_32FC2);
+  parallel_for_(Range(0, viewSize.height), [&](const Range &rows) {
+    for (int y = rows.start; y < rows.end; y++) {
+      Vec2f *out = map.ptr<Vec2f>(y);
+      float up = (0.5f * viewSize.height - (y + 0.5f)) / focal;
+      for (int x = 0; x < viewSize.width; x++) {
+        // a pinhole camera looking ahead, tilted up by pitch and then turned right by yaw
+        Vec3f ray((x + 0.5f - 0.5f * viewSize.width) / focal, up, 1.0f);
+        Vec3f tilted(ray[0], ray[1] * cosPitch + ray[2] * sinPitch, ray[2] * cosPitch - ray[1] * sinPitch);
+        Vec3f dir(tilted[0] * cosYaw + tilted[2] * sinYaw, tilted[1], tilted[2] * cosYaw - tilted[0] * sinYaw);
+        out[x] = project(lenses, dir * (1.0f / (float)norm(dir)));
+      }
+    }
+  });
+  return map;
+}
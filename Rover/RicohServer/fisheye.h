@@ -0,0 +1,42 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+/*
+   One lens of a dual fisheye camera, as it shows up in the raw frame. The lens
+   is equidistant, the distance from the center of the circle grows with the
+   angle from the lens axis.
+ */
+struct fisheye_lens
+{
+  float cx, cy;   // center of the image circle in the raw frame
+  float radius;   // radius of the image circle in pixels
+  float fov;      // angle the whole circle covers, in degrees
+  float rotation; // where the scene's right points to in the frame, degrees clockwise from +x
+  float yaw;      // where the lens looks in the panorama, degrees right of its center
+};
+
+/*
+   The two lenses of our Ricoh THETA S in its 1280x720 frame. The centers and
+   radius come from the crops split has always used. The lenses look sideways,
+   left to the left half of the panorama and right to the right half, as the
+   remap tables laid them out.
+ */
+const fisheye_lens THETA_LEFT = { 311.0f, 322.0f, 290.0f, 190.0f, -90.0f, -90.0f };
+const fisheye_lens THETA_RIGHT = { 967.0f, 330.0f, 290.0f, 190.0f, 90.0f, 90.0f };
+
+/*
+   Builds the map from the raw frame to an equirectangular panorama of any size,
+   360 degrees across and 180 degrees down. Each pixel comes from the lens whose
+   axis is closest. The map is CV_32FC2 for fixedPointMap, and rows are built in
+   parallel.
+ */
+cv::Mat fisheyeMap(const fisheye_lens &left, const fisheye_lens &right, cv::Size panoSize);
+
+/*
+   Builds the map for a window of the sphere, as a camera with a field of view of
+   fov degrees across would see it. yaw turns it right of the panorama's center
+   and pitch tilts it up, both in degrees. Only the pixels of the window get
+   dewarped, so the cost follows viewSize and not the sphere.
+ */
+cv::Mat viewportMap(const fisheye_lens &left, const fisheye_lens &right, float yaw, float pitch, float fov, cv::Size viewSize);
@@ -10,6 +10,11 @@
 
 #include "gserver.h"
 #include "ricoh.cpp"
+#include "thetadewarp.h"
+#include "viewport.h"
+#include "encoder.h"
+#include "demand.h"
+#include "timestamp.h"
 GMainLoop *loop;
 std::vector<std::thread> threads;
 
@@ -60,15 +65,13 @@ gboolean bus_func (GstBus *bus, GstMessage *message, gpointer user_data)
 
 // v4l2src device="/dev/video0" ! 
 // "video/x-raw, format=(string)I420, width=(int)1280, height=(int)720" ! 
-// omxh264enc ! 
-// 'video/x-h264, stream-format=(string)byte-stream' ! 
-// h264parse ! 
-// rtph264pay ! 
+// encoder (omxh264enc, x264enc, openh264enc or jpegenc, see encoder.h) ! 
+// payloader ! 
 // udpsink host=192.168.0.5 port=5555
 g_element start_device(GstDevice *dev, const char *client) 
 {
   g_element ele = (g_element)malloc(sizeof(g_element_st));
-  GstCaps *s_cap_unapplied, *e_cap_unapplied, *scale_cap_unapplied;
+  GstCaps *s_cap_unapplied, *scale_cap_unapplied;
   GstCaps *v_cap_unapplied;
 
   ele->name = gst_device_get_display_name(dev);
@@ -83,15 +86,19 @@ g_element start_device(GstDevice *dev, const char *client)
                                                              /* opencv object dir */
   ele->source = gst_element_factory_make("v4l2src", NULL);        // cap
   ele->s_cap = gst_element_factory_make("capsfilter", NULL);      // cap
-  ele->encoder = gst_element_factory_make("omxh264enc", NULL);    // writer 
-  ele->e_cap = gst_element_factory_make("capsfilter", NULL);      // writer
-  ele->depay = gst_element_factory_make("rtph264pay", NULL);      // writer
-  ele->parse = gst_element_factory_make("h264parse", NULL);       // writer
+  ele->depay = gst_element_factory_make(encoder_payloader(probe_encoder()), NULL); // writer
   ele->sink = gst_element_factory_make("udpsink", NULL);          // writer
   ele->scale = gst_element_factory_make("videoscale", NULL);      // cap ?
   ele->scale_cap = gst_element_factory_make("capsfilter", NULL);  // cap ?
   ele->video_rate = gst_element_factory_make("videorate", NULL);  // cap
   ele->v_cap = gst_element_factory_make("capsfilter", NULL);      // cap 
+  ele->dewarp = NULL;
+  if (strcmp(ele->name, "RICOH THETA S") == 0)
+  {
+    // the panorama width takes the place of the scaling
+    ele->dewarp = gst_element_factory_make("thetadewarp", NULL);
+    g_object_set(G_OBJECT(ele->dewarp), "width", panoWidth, NULL);
+  }
 
   // options for the source  
   g_object_set(G_OBJECT(ele->source), "device", gst_structure_get_string(ele->str, "device.path"), NULL);
@@ -108,10 +115,21 @@ g_element start_device(GstDevice *dev, const char *client)
                           "height", G_TYPE_INT, std::get<1>(table[ele->name]), NULL);
   g_object_set(G_OBJECT(ele->s_cap), "caps", s_cap_unapplied, NULL);
 
-  // options for the encoder
-  e_cap_unapplied = gst_caps_new_simple("video/x-h264", "stream-format", 
-                                     G_TYPE_STRING, "byte-stream", NULL);
-  g_object_set(G_OBJECT(ele->e_cap), "caps", e_cap_unapplied, NULL);
+  // the encoder is a bin of the encoder, its caps and parser, sized for what it is sent
+  int sent_width = std::get<3>(table[ele->name]), sent_height = std::get<4>(table[ele->name]);
+  if (ele->dewarp)
+  {
+    cv::Size pano = panoramaSize(panoWidth);
+    sent_width = pano.width;
+    sent_height = pano.height;
+  }
+  std::string encoder = encoder_launch(probe_encoder(), default_bitrate(sent_width, sent_height, 10), 10);
+  ele->encoder = gst_parse_bin_from_description(encoder.c_str(), TRUE, NULL);     // writer
+  if (ele->depay && probe_encoder() != ENCODER_JPEG && probe_encoder() != ENCODER_RAW)
+  {
+    // the stream parameters with every keyframe, so the base station can join late
+    g_object_set(G_OBJECT(ele->depay), "config-interval", -1, NULL);
+  }
 
   // options for the videoscalar
   scale_cap_unapplied = gst_caps_new_simple("video/x-raw","format",G_TYPE_STRING,"I420",
@@ -128,7 +146,7 @@ g_element start_device(GstDevice *dev, const char *client)
   g_object_set(G_OBJECT(ele->sink), "host", client, "port", std::get<2>(table[ele->name]), NULL);
   
   // there is no reason this should fail other than the programmer not making something correctly
-  if (!ele->pipeline || !ele->source || !ele->s_cap || !ele->e_cap || !ele->depay || !ele->encoder || !ele->parse || !ele->sink || !ele->scale || !ele->scale_cap || !ele->video_rate || !ele->v_cap) 
+  if (!ele->pipeline || !ele->source || !ele->s_cap || !ele->depay || !ele->encoder || !ele->sink || !ele->scale || !ele->scale_cap || !ele->video_rate || !ele->v_cap || (strcmp(ele->name, "RICOH THETA S") == 0 && !ele->dewarp)) 
   { 
     g_printerr ("One element could not be created. SAD! \n");
     exit(-1);
@@ -167,23 +185,71 @@ void stream_start(GList *cur, gchar *ip, gint stream_duplication_num)
   int retries = 0;
   ele = start_device((GstDevice*) cur->data, ip);
   
-  if (strcmp(ele->name, "RICOH THETA S") != 0) 
+  if (!ele->dewarp || ricohMode != RICOH_APPSINK) 
   {
-    gst_bin_add_many(GST_BIN(ele->pipeline), ele->source, ele->s_cap, ele->e_cap, 
-                     ele->depay, ele->encoder, ele->parse, ele->sink, ele->scale, 
-                     ele->scale_cap, ele->video_rate, ele->v_cap, NULL);
+    gboolean linked;
+    gboolean on_demand = FALSE;
+    if (ele->dewarp && ricohMode == RICOH_VIEWPORT)
+    {
+      // the raw frames go to the rtsp server, which dewarps a view for each client.
+      // The camera only runs while someone watches a view.
+      GstElement *inter = gst_element_factory_make("intervideosink", NULL);
+      g_object_set(G_OBJECT(inter), "channel", RICOH_CHANNEL, NULL);
+      gst_bin_add_many(GST_BIN(ele->pipeline), ele->source, ele->s_cap, 
+                       ele->video_rate, ele->v_cap, inter, NULL);
+      demand *camera = new demand;
+      GstElement *pipeline = ele->pipeline;
+      camera->start = [pipeline]() {
+        printf("ricoh views watched, starting the camera\n");
+        if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+        {
+          printf("can't start the ricoh\n");
+        }
+      };
+      camera->stop = [pipeline]() {
+        printf("nobody watching the ricoh, camera idle\n");
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+      };
+      on_demand = TRUE;
+      linked = gst_element_link_many(ele->source, ele->s_cap, ele->video_rate, ele->v_cap, 
+                                     inter, NULL)
+               && start_viewports(RICOH_RTSP_PORT, RICOH_CHANNEL, camera);
+    }
+    else if (ele->dewarp)
+    {
+      // the ricoh is dewarped in the pipeline, the frames never leave gstreamer
+      gst_bin_add_many(GST_BIN(ele->pipeline), ele->source, ele->s_cap, 
+                       ele->depay, ele->encoder, ele->sink, ele->dewarp, 
+                       ele->video_rate, ele->v_cap, NULL);
+      linked = gst_element_link_many(ele->source, ele->s_cap, ele->video_rate, ele->v_cap, 
+                                     ele->dewarp, ele->encoder, ele->depay, ele->sink, NULL);
+    }
+    else
+    {
+      gst_bin_add_many(GST_BIN(ele->pipeline), ele->source, ele->s_cap, 
+                       ele->depay, ele->encoder, ele->sink, ele->scale, 
+                       ele->scale_cap, ele->video_rate, ele->v_cap, NULL);
+      linked = gst_element_link_many(ele->source, ele->s_cap, ele->video_rate, ele->v_cap, 
+                                     ele->scale, ele->scale_cap, ele->encoder, 
+                                     ele->depay, ele->sink, NULL);
+    }
  
-    if (!gst_element_link_many(ele->source, ele->s_cap, ele->video_rate, ele->v_cap, 
-                               ele->scale, ele->scale_cap, ele->encoder, ele->e_cap, 
-                               ele->parse, ele->depay, ele->sink, NULL)) 
+    if (!linked) 
     {
       g_printerr ("unable to link the elments to the pipeline. SAD! \n");
       exit(-1);
     } 
 
+    // every frame carries the time it left the camera, out to the base station
+    stamp_capture(ele->source);
+    if (!on_demand)
+    {
+      carry_capture(ele->depay);
+    }
+
  
   // try and set the state of the camera pipeline, retry 5 times exit if it can't 
-    while (gst_element_set_state(ele->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    while (!on_demand && gst_element_set_state(ele->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
     {
       printf("oh no did not start %s, going to retry \n", ele->name);
       retries ++;
@@ -198,8 +264,7 @@ void stream_start(GList *cur, gchar *ip, gint stream_duplication_num)
   // ricoh specific stream things 
   else 
   {
-    // this is where we put stuff for the richo cam
-    // We still need to break up the pipe and send things accordingly
+    // the old path through opencv, it prints how long each frame takes
     printf("starting the ricoh \n");
     r_start(ele, ip);
   }
@@ -220,19 +285,38 @@ int main(int argc, char *argv[])
   gint stream_duplication_number = 0;
   char *ip;
   gst_init(&argc, &argv);
+  gst_theta_dewarp_register(NULL);
 
   if (argc > 1)
   {
     ip = argv[1];
   }
-  else if (argc > 2) 
+  else 
+  {
+    ip = (char*)"192.168.0.5";
+  }
+  if (argc > 2) 
   {
-    ip = argv[1];
     stream_duplication_number = atoi(argv[2]);
   }
-  else 
+  if (argc > 3)
   {
-    ip = (char*)"192.168.0.5";
+    panoWidth = atoi(argv[3]);
+  }
+  if (argc > 4)
+  {
+    if (strcmp(argv[4], "appsink") == 0)
+    {
+      ricohMode = RICOH_APPSINK;
+    }
+    else if (strcmp(argv[4], "viewport") == 0)
+    {
+      ricohMode = RICOH_VIEWPORT;
+    }
+  }
+  if (argc > 5)
+  {
+    standby_seconds = atoi(argv[5]);
   }
   printf("ip is set to: %s\n\n", ip);
   // signal for closing
@@ -7,9 +7,10 @@ typedef struct g_element_st
 {
   gchar *name, *cl;
   GstStructure *str;
-  GstElement *pipeline, *source, *depay, *encoder;
-  GstElement *parse, *sink, *s_cap, *e_cap, *scale;
+  GstElement *pipeline, *source, *depay, *encoder; // encoder is a bin, see encoder.h
+  GstElement *sink, *s_cap, *scale;
   GstElement *scale_cap, *video_rate, *v_cap;
+  GstElement *dewarp; // thetadewarp for the ricoh, NULL for the others
 
 } *g_element;
 
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/core.hpp>
+
+// A frame on its way through the stages of the stream, stamped when it was captured.
+struct stamped_frame
+{
+  cv::Mat image;
+  int64_t captured = 0; // steady clock in ns
+  uint64_t number = 0;  // counts up from 1
+};
+
+/*
+   Hands the newest frame from one stage to the next. Frames are swapped in and
+   out instead of copied, so the same few buffers go round between the stages
+   and nothing gets allocated per frame. A stage that falls behind gets the
+   newest frame and the ones in between are dropped.
+ */
+class latest_frame
+{
+public:
+  // swaps f into the slot, f gets back an old buffer to fill next
+  void publish(stamped_frame &f)
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      std::swap(latest, f);
+    }
+    cond.notify_one();
+  }
+
+  // waits for a frame newer than last and swaps it into f, false once closed
+  bool take(uint64_t last, stamped_frame &f)
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    cond.wait(guard, [&] { return closed || latest.number > last; });
+    if (closed) {
+      return false;
+    }
+    std::swap(latest, f);
+    return true;
+  }
+
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      closed = true;
+    }
+    cond.notify_all();
+  }
+
+private:
+  std::mutex lock;
+  std::condition_variable cond;
+  stamped_frame latest;
+  bool closed = false;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+   The remap table compiled from remap_x.txt and remap_y.txt by compile-remap.
+   The header is followed by rows * cols pairs of int16 (x, y), row after row,
+   in the byte order of the machine that compiled it. The table is mapped
+   straight into memory at startup, nothing gets parsed.
+ */
+#define REMAP_MAGIC 0x50414d52 // "RMAP"
+#define REMAP_VERSION 1
+#define REMAP_FILE "remap.bin"
+
+struct remap_header
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t cols;
+  uint16_t rows;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(remap_header) == 12, "the header is part of the file format");
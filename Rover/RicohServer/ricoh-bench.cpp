@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "dewarp.h"
+#include "fisheye.h"
+
+using namespace cv;
+
+#if CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR < 1
+typedef int access_flags;
+#else
+typedef AccessFlag access_flags;
+#endif
+
+/*
+   Counts every Mat buffer allocated while it is the default allocator, the
+   work itself is left to OpenCV's own allocator.
+ */
+class counting_allocator : public MatAllocator
+{
+public:
+  UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, access_flags flags, UMatUsageFlags usageFlags) const override
+  {
+    count++;
+    return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+  }
+
+  bool allocate(UMatData *data, access_flags flags, UMatUsageFlags usageFlags) const override
+  {
+    return Mat::getStdAllocator()->allocate(data, flags, usageFlags);
+  }
+
+  void deallocate(UMatData *data) const override
+  {
+    Mat::getStdAllocator()->deallocate(data);
+  }
+
+  mutable std::atomic<uint64_t> count{0};
+};
+
+static counting_allocator allocations;
+
+// time and allocations of one stage, added up over every frame
+struct stage
+{
+  const char *name;
+  int64_t ns;
+  uint64_t allocations;
+};
+
+template<typename F>
+static void timeStage(stage &s, F &&run)
+{
+  uint64_t before = allocations.count;
+  auto start = std::chrono::steady_clock::now();
+  run();
+  s.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  s.allocations += allocations.count - before;
+}
+
+/*
+   A dual fisheye frame like the camera's: the two image circles where the
+   lenses are, filled with a pattern of rings and spokes that turns with n so
+   no two frames are the same, plus sensor noise.
+ */
+static Mat syntheticFrame(int n)
+{
+  Mat frame(720, 1280, CV_8UC3, Scalar(0, 0, 0));
+  for (const fisheye_lens &lens : { THETA_LEFT, THETA_RIGHT }) {
+    for (int y = 0; y < frame.rows; y++) {
+      Vec3b *row = frame.ptr<Vec3b>(y);
+      for (int x = 0; x < frame.cols; x++) {
+        float dx = x - lens.cx, dy = y - lens.cy;
+        float r = sqrtf(dx * dx + dy * dy);
+        if (r > lens.radius) {
+          continue;
+        }
+        int ring = (int)(r / 24.0f);
+        int spoke = (int)((atan2f(dy, dx) + CV_PI) * 12.0f / CV_PI + n * 0.25f);
+        uchar shade = (ring + spoke) % 2 ? 200 : 60;
+        row[x] = Vec3b(shade, (uchar)(r * 255 / lens.radius), (uchar)(lens.cx / 5));
+      }
+    }
+  }
+  Mat noise(frame.size(), CV_8UC3);
+  randu(noise, 0, 16);
+  frame += noise;
+  return frame;
+}
+
+// FNV-1a over the pixels, row by row so views hash like copies
+static uint64_t checksum(const Mat &image)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  size_t rowBytes = image.cols * image.elemSize();
+  for (int y = 0; y < image.rows; y++) {
+    const uchar *p = image.ptr<uchar>(y);
+    for (size_t i = 0; i < rowBytes; i++) {
+      hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+/*
+   ./ricoh-bench [recording] [frames]
+
+   Runs frames through the step by step dewarp and the kernels that replaced it,
+   and prints each one's time and Mat allocations per frame. Without a recording
+   of the camera it makes up frames. The fused dewarp and OpenCV's remap of the
+   same map have to give the step by step panorama to the byte.
+ */
+int main(int argc, char *argv[])
+{
+  int runs = argc > 2 ? atoi(argv[2]) : 100;
+  if (runs < 1) {
+    printf("frames has to be a number of at least 1, not %s\n", argv[2]);
+    return 1;
+  }
+  std::vector<Mat> frames;
+  if (argc > 1) {
+    VideoCapture cap(argv[1]);
+    Mat frame;
+    while ((int)frames.size() < runs && cap.read(frame) && !frame.empty()) {
+      frames.push_back(frame.clone());
+    }
+    if (frames.empty()) {
+      printf("can't read frames from %s\n", argv[1]);
+      return 1;
+    }
+  }
+  else {
+    for (int n = 0; n < 30; n++) {
+      frames.push_back(syntheticFrame(n));
+    }
+  }
+  if (!loadRemap(remapPath())) {
+    return 1;
+  }
+  Size frameSize = frames[0].size();
+  // the step by step dewarp only knows the camera's own frames
+  if (frameSize != THETA_FRAME) {
+    printf("frames are %dx%d, the bench needs %dx%d\n", frameSize.width, frameSize.height,
+           THETA_FRAME.width, THETA_FRAME.height);
+    return 1;
+  }
+
+  // maps are built once at startup in the server too, so they are not timed
+  Mat fused = panoramaMap(frameSize);
+  dewarp_map tables = fixedPointMap(fused, frameSize, false);
+  dewarp_map lens;
+  dewarp_view pano;
+  pano.width = 2 * COLS;
+  dewarp_map viewport;
+  dewarp_view view;
+  view.width = 640;
+  view.fov = 90.0f;
+  if (!viewMap(frameSize, pano, lens) || !viewMap(frameSize, view, viewport)) {
+    printf("can't build the view maps\n");
+    return 1;
+  }
+
+  enum { SPLIT, ORIENT, RECT, STITCH, FUSED, REMAP, LENS, VIEWPORT, STAGES };
+  stage stages[STAGES] = {
+    { "split", 0, 0 },
+    { "correctOrientation", 0, 0 },
+    { "fisheyeToRect", 0, 0 },
+    { "stitch", 0, 0 },
+    { "dewarp, remap tables", 0, 0 },
+    { "cv::remap, same map", 0, 0 },
+    { "dewarp, lens bilinear", 0, 0 },
+    { "dewarp, 640x480 view", 0, 0 },
+  };
+
+  Mat::setDefaultAllocator(&allocations);
+  Mat fusedPano, remapPano, lensPano, viewPano;
+  int fusedMatches = 0, remapMatches = 0;
+  // the first frame warms up the caches and the reused outputs, it isn't counted
+  for (int i = -1; i < runs; i++) {
+    const Mat &frame = frames[(i + frames.size()) % frames.size()];
+    stage s[STAGES] = {};
+
+    std::pair<Mat, Mat> halves;
+    Mat reference;
+    timeStage(s[SPLIT], [&] { halves = split(frame); });
+    timeStage(s[ORIENT], [&] { halves = correctOrientation(halves); });
+    timeStage(s[RECT], [&] { halves = fisheyeToRect(halves); });
+    timeStage(s[STITCH], [&] { reference = stitch(halves); });
+    timeStage(s[FUSED], [&] { dewarp(frame, tables, fusedPano); });
+    timeStage(s[REMAP], [&] { remap(frame, remapPano, fused, Mat(), INTER_NEAREST); });
+    timeStage(s[LENS], [&] { dewarp(frame, lens, lensPano); });
+    timeStage(s[VIEWPORT], [&] { dewarp(frame, viewport, viewPano); });
+
+    if (i < 0) {
+      continue;
+    }
+    for (int k = 0; k < STAGES; k++) {
+      stages[k].ns += s[k].ns;
+      stages[k].allocations += s[k].allocations;
+    }
+    uint64_t expected = checksum(reference);
+    fusedMatches += checksum(fusedPano) == expected;
+    remapMatches += checksum(remapPano) == expected;
+  }
+  Mat::setDefaultAllocator(NULL);
+
+  printf("%d frames of %dx%d, %s, %d threads\n", runs, frameSize.width, frameSize.height,
+         argc > 1 ? argv[1] : "synthetic", getNumThreads());
+  printf("%-24s %12s %14s\n", "stage", "ns/frame", "allocs/frame");
+  int64_t referenceNs = 0;
+  for (int k = 0; k < STAGES; k++) {
+    printf("%-24s %12lld %14.2f\n", stages[k].name, (long long)(stages[k].ns / runs), (double)stages[k].allocations / runs);
+    if (k <= STITCH) {
+      referenceNs += stages[k].ns;
+    }
+    if (k == STITCH) {
+      printf("%-24s %12lld\n", "step by step total", (long long)(referenceNs / runs));
+    }
+  }
+  printf("checksums: fused %d/%d and cv::remap %d/%d frames match step by step\n", fusedMatches, runs, remapMatches, runs);
+  return fusedMatches == runs && remapMatches == runs ? 0 : 1;
+}
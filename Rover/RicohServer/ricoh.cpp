@@ -1,138 +1,87 @@
 #include <stdio.h>
 #include <gst/gst.h>
 #include "gserver.h"
+#include "dewarp.h"
+#include "latest.h"
+#include "encoder.h"
 #include <opencv2/opencv.hpp>
-#include <opencv2/highgui/highgui.hpp>
 #include <iostream>
 #include <string>
+#include <chrono>
+#include <thread>
 
 using namespace cv;
 using namespace std;
 
-//Found these through experimentation.
-const int COLS = 572;
-const int ROWS = 592;
+// Width of the panorama sent, 0 keeps the 1144x592 one of the remap tables. Any
+// other width gets an equirectangular panorama half as high, built from the lens
+// parameters, so a weak link can get a smaller one without dewarping it big first.
+int panoWidth = 0;
 
-std::pair<int, int> coordinates[COLS][ROWS];
+// How the ricoh is streamed, the fourth argument of gserver. RICOH_DEWARP sends
+// the panorama with thetadewarp in the camera's pipeline, RICOH_APPSINK dewarps
+// through appsink and appsrc in r_start, and RICOH_VIEWPORT serves a view for
+// each RTSP client.
+enum ricoh_mode { RICOH_DEWARP, RICOH_APPSINK, RICOH_VIEWPORT };
+ricoh_mode ricohMode = RICOH_DEWARP;
 
-/*
-   Splits the provided image into two. Splitting occurs at the middle of width.
-   Returns a pair of Mat objects. First is the left half. Second is right.
- */
-std::pair<Mat,Mat> split(Mat dualFisheye)
-{	
-  //----------------------------------------------------------------------------------------
-  //DO NOT MESS WITH THESE VALUES UNLESS TOTALLY NECESSARY. THEY HAVE BEEN SELECTED FOR OUR 
-  //PARTICULAR RICOH THETEA S THROUGH EXPERIMENTATION.
-  //----------------------------------------------------------------------------------------
-  cv::Rect roi;
-  roi.x = 15;
-  roi.y = 36;
-  roi.width = dualFisheye.cols / 2 - 48; // ROWS
-  roi.height = dualFisheye.rows - 148;   // COLS
-  //Crop the image using these parameters.
-  Mat left = dualFisheye(roi);
-  //Crop the other half.
-  roi.x = dualFisheye.cols / 2 + 31;
-  roi.y = 44;
-  roi.width = dualFisheye.cols / 2 - 48;
-  roi.height = dualFisheye.rows - 148 ;
-  Mat right = dualFisheye(roi);
-  return std::make_pair(left, right);
-}
+// The THETA S streams 1280x720 at 15 fps over USB.
+const int frames_per_second = 15;
 
-/*
-   This will take separated images from the feed of the Ricoh Theta S. It will
-   straighten the images to get the actual top facing up. 
-   Accepts a pair of images. The first is the left feed and second is right feed. 
- */
-std::pair<Mat, Mat> correctOrientation(std::pair<Mat, Mat> feed)
+static int64_t nowNs()
 {
-  transpose(feed.first, feed.first);
-  flip(feed.first, feed.first, +1);
-  transpose(feed.second, feed.second);
-  flip(feed.second, feed.second, 0);
-  return feed;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 /*
-   This will do the transformation from the circular to rectangular field.
-   Will be using the maps stored in coordinates pair of array.
+   Reads frames from the camera as fast as it gives them and hands on the newest.
+   Closes the slot when the camera goes away, which stops the other stages.
  */
-std::pair<Mat, Mat> fisheyeToRect(std::pair<Mat, Mat> feed)
+static void captureStage(VideoCapture &cap, latest_frame &raw)
 {
-  Mat leftSq(feed.first.rows, feed.first.cols, CV_8UC3);
-  Mat rightSq(feed.second.rows, feed.second.cols, CV_8UC3);
-  for (int y = 0; y < ROWS; y++) {
-    for (int x = 0; x < COLS; x++) {
-      //The vector goes rows X cols
-      leftSq.at<Vec3b>(y, x) = feed.first.at<Vec3b>(coordinates[x][y].second, coordinates[x][y].first);
-      rightSq.at<Vec3b>(y, x) = feed.second.at<Vec3b>(coordinates[x][y].second, coordinates[x][y].first);
-    }
+  stamped_frame f;
+  uint64_t number = 0;
+  while (cap.read(f.image) && !f.image.empty())
+  {
+    f.captured = nowNs();
+    f.number = ++number;
+    raw.publish(f);
   }
-  return std::make_pair(leftSq, rightSq);
+  cout << "Lost the dual fisheye from the camera" << endl;
+  raw.close();
 }
 
 /*
-   Will take a feed and will put them together in one Mat object.
-   Will return this new image.
+   Dewarps the newest raw frame into a panorama, keeping its capture time.
  */
-Mat stitch(std::pair<Mat, Mat> feed)
+static void dewarpStage(const dewarp_map &map, latest_frame &raw, latest_frame &panos)
 {
-  Mat pano(feed.first.rows, feed.first.cols * 2, CV_8UC3);
-  feed.first.copyTo(pano(Rect(0, 0, feed.first.cols, feed.first.rows)));
-  feed.second.copyTo(pano(Rect(feed.first.cols, 0, feed.second.cols, feed.second.rows)));
-  return pano;
-}
-
-/*
-   Reads the remap file and writes the pixel maps to coordinates.
-   Files were generated using a java program remapping.java. It is in the same
-   directory as this program.
- */
-void saveToArray() 
-{
-  std::ifstream X("remap_x.txt");
-  std::ifstream Y("remap_y.txt");
-  std::string lineX;
-  std::string lineY;
-  int row = 0;
-  while (std::getline(X, lineX) && std::getline(Y, lineY))
+  stamped_frame in, out;
+  uint64_t last = 0;
+  while (raw.take(last, in))
   {
-    std::stringstream streamX(lineX);
-    std::stringstream streamY(lineY);
-    int col = 0;
-    while (col < COLS)
-    {
-      int x;
-      streamX >> x;
-      int y;
-      streamY >> y;
-      if (x > COLS)
-      {
-        x = COLS;
-      }
-      if (y > ROWS)
-      {
-        y = ROWS;
-      }
-      coordinates[col][row] = std::make_pair(x, y);
-      col++;
-    }
-    row++;
+    last = in.number;
+    dewarp(in.image, map, out.image);
+    out.captured = in.captured;
+    out.number = in.number;
+    panos.publish(out);
   }
+  panos.close();
 }
 
 int r_start(g_element ele, gchar *ip) {
   const gchar *path = gst_structure_get_string(ele->str, "device.path");
 
-  // string for getting image data from ricoh
+  // string for getting image data from ricoh. The appsink keeps only the newest
+  // frame, a stage that falls behind drops frames instead of adding latency.
   std::string inward_stream;
-  inward_stream += "v4l2src device=" + std::string(path) + " ! video/x-raw, format=BGR, width=1280, height=720 ! videorate ! video/x-raw, framerate=(fraction)10/1 ! appsink";
+  inward_stream += "v4l2src device=" + std::string(path) + " ! video/x-raw, format=BGR, width=1280, height=720 ! videorate ! video/x-raw, framerate=(fraction)" + std::to_string(frames_per_second) + "/1 ! appsink max-buffers=1 drop=true sync=false";
 
-  // string for sending 
+  // string for sending. udpsink sends each frame as soon as it is encoded.
   std::string outward_stream;
-  outward_stream += "appsrc ! autovideoconvert ! omxh264enc ! video/x-h264, stream-format=(string)byte-stream ! h264parse ! rtph264pay ! udpsink host=" + std::string(ip) + "port=5555";
+  Size panoSize = panoramaSize(panoWidth);
+  encoder_kind kind = probe_encoder();
+  outward_stream += "appsrc ! autovideoconvert ! video/x-raw, format=I420 ! " + encoder_launch(kind, default_bitrate(panoSize.width, panoSize.height, frames_per_second), frames_per_second) + " ! " + encoder_payloader(kind) + " ! udpsink sync=false host=" + std::string(ip) + " port=5555";
   // creating the capture 
   VideoCapture cap(inward_stream, CAP_GSTREAMER);
   Mat dualFisheye;
@@ -143,32 +92,51 @@ int r_start(g_element ele, gchar *ip) {
     exit(0);
   }
   g_print("made the cap\n");
-  saveToArray();
+  dewarp_map map;
+  dewarp_view pano;
+  pano.width = panoWidth;
+  if (!viewMap(dualFisheye.size(), pano, map)) {
+    cout << "There was an error loading the remap table" << endl;
+    exit(0);
+  }
 
-  //Found these values through testing.
-  Size frame_size(1144, 592);
-  int frames_per_second = 10;
+  Size frame_size = map.xy.size();
   //Create and initialize the VideoWriter object 
   cv::VideoWriter writer;
-  writer.open(outward_stream, CAP_GSTREAMER, 0, 10, Size(1144, 592), true);
+  writer.open(outward_stream, CAP_GSTREAMER, 0, frames_per_second, frame_size, true);
 
-  // namedWindow("image Final", WINDOW_AUTOSIZE);
+  // capture, dewarp and encode each run on their own, so the stream goes as
+  // fast as the slowest of them instead of all three added up
+  latest_frame raw, panos;
+  std::thread capture(captureStage, std::ref(cap), std::ref(raw));
+  std::thread dewarping(dewarpStage, std::cref(map), std::ref(raw), std::ref(panos));
 
-  while (true)
+  stamped_frame f;
+  uint64_t last = 0, sent = 0, dropped = 0;
+  int64_t latency = 0, maxLatency = 0;
+  int64_t reported = nowNs();
+  while (panos.take(last, f))
   {
-    cap.read(dualFisheye);
-    //separate the feed and crop to bounding square
-    std::pair<Mat, Mat> separated = split(dualFisheye);
-    //correct orientation of the separated feed.
-    separated = correctOrientation(separated);
-    //Convert the separated feed to rectangular.
-    separated = fisheyeToRect(separated);
-    //Stitch the two feeds together
-    Mat pano = stitch(separated);
-    // imshow("image Final", pano);
-    writer.write(pano);
-    if (waitKey(30) == 27) break;
+    dropped += f.number - last - 1;
+    last = f.number;
+    writer.write(f.image);
+
+    // capture to handing the panorama to the encoder
+    int64_t now = nowNs();
+    latency += now - f.captured;
+    maxLatency = std::max(maxLatency, now - f.captured);
+    sent++;
+    if (now - reported >= 5000000000LL)
+    {
+      printf("ricoh: %.1f fps, latency %.1f ms mean %.1f ms max, %lu dropped\n",
+             sent * 1e9 / (now - reported), latency / 1e6 / sent, maxLatency / 1e6, (unsigned long)dropped);
+      sent = dropped = 0;
+      latency = maxLatency = 0;
+      reported = now;
+    }
   }
+  capture.join();
+  dewarping.join();
   writer.release();
   return 0;
 }
@@ -0,0 +1,222 @@
+#include "thetadewarp.h"
+
+GST_DEBUG_CATEGORY_STATIC(theta_dewarp_debug);
+#define GST_CAT_DEFAULT theta_dewarp_debug
+
+enum
+{
+  PROP_0,
+  PROP_WIDTH,
+  PROP_YAW,
+  PROP_PITCH,
+  PROP_FOV
+};
+
+#define THETA_DEWARP_CAPS GST_VIDEO_CAPS_MAKE("{ BGR, RGB, I420 }")
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS(THETA_DEWARP_CAPS));
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(THETA_DEWARP_CAPS));
+
+G_DEFINE_TYPE(GstThetaDewarp, gst_theta_dewarp, GST_TYPE_VIDEO_FILTER);
+
+static void gst_theta_dewarp_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+  GstThetaDewarp *self = GST_THETA_DEWARP(object);
+  switch (prop_id) {
+    case PROP_WIDTH:
+      self->view->width = g_value_get_int(value);
+      break;
+    case PROP_YAW:
+      self->view->yaw = g_value_get_float(value);
+      break;
+    case PROP_PITCH:
+      self->view->pitch = g_value_get_float(value);
+      break;
+    case PROP_FOV:
+      self->view->fov = g_value_get_float(value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      return;
+  }
+  gst_base_transform_reconfigure_src(GST_BASE_TRANSFORM(self));
+}
+
+static void gst_theta_dewarp_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+  GstThetaDewarp *self = GST_THETA_DEWARP(object);
+  switch (prop_id) {
+    case PROP_WIDTH:
+      g_value_set_int(value, self->view->width);
+      break;
+    case PROP_YAW:
+      g_value_set_float(value, self->view->yaw);
+      break;
+    case PROP_PITCH:
+      g_value_set_float(value, self->view->pitch);
+      break;
+    case PROP_FOV:
+      g_value_set_float(value, self->view->fov);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+      break;
+  }
+}
+
+static void gst_theta_dewarp_finalize(GObject *object)
+{
+  GstThetaDewarp *self = GST_THETA_DEWARP(object);
+  delete self->view;
+  delete self->map;
+  delete self->chroma;
+  G_OBJECT_CLASS(gst_theta_dewarp_parent_class)->finalize(object);
+}
+
+/*
+   Downstream gets the size of the view. Upstream can be any size the map is
+   built for whatever it turns out to be, except for the panorama of the remap
+   tables, which only fit the camera's own frames.
+ */
+static GstCaps *gst_theta_dewarp_transform_caps(GstBaseTransform *trans, GstPadDirection direction, GstCaps *caps, GstCaps *filter)
+{
+  GstThetaDewarp *self = GST_THETA_DEWARP(trans);
+  GstCaps *result = gst_caps_copy(caps);
+  for (guint i = 0; i < gst_caps_get_size(result); i++) {
+    GstStructure *s = gst_caps_get_structure(result, i);
+    if (direction == GST_PAD_SINK) {
+      cv::Size size = viewSize(*self->view);
+      gst_structure_set(s, "width", G_TYPE_INT, size.width, "height", G_TYPE_INT, size.height,
+                        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+    }
+    else {
+      if (self->view->width <= 0 && self->view->fov <= 0.0f) {
+        gst_structure_set(s, "width", G_TYPE_INT, THETA_FRAME.width, "height", G_TYPE_INT, THETA_FRAME.height, NULL);
+      }
+      else {
+        gst_structure_set(s, "width", GST_TYPE_INT_RANGE, 2, G_MAXINT, "height", GST_TYPE_INT_RANGE, 2, G_MAXINT, NULL);
+      }
+      gst_structure_remove_field(s, "pixel-aspect-ratio");
+    }
+  }
+  if (filter) {
+    GstCaps *filtered = gst_caps_intersect_full(filter, result, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref(result);
+    result = filtered;
+  }
+  return result;
+}
+
+static gboolean gst_theta_dewarp_set_info(GstVideoFilter *filter, GstCaps *incaps, GstVideoInfo *in_info, GstCaps *outcaps, GstVideoInfo *out_info)
+{
+  GstThetaDewarp *self = GST_THETA_DEWARP(filter);
+  cv::Size frameSize(GST_VIDEO_INFO_WIDTH(in_info), GST_VIDEO_INFO_HEIGHT(in_info));
+  // viewers of the same view share its maps, a new view builds them once.
+  // OpenCV's checks throw, which must not unwind through GStreamer.
+  try {
+    *self->map = cachedViewMap(frameSize, *self->view, false);
+    self->chroma->reset();
+    if (*self->map && GST_VIDEO_INFO_FORMAT(in_info) == GST_VIDEO_FORMAT_I420) {
+      *self->chroma = cachedViewMap(frameSize, *self->view, true);
+    }
+  }
+  catch (const cv::Exception &e) {
+    GST_ERROR_OBJECT(self, "can't build the map for %dx%d: %s", frameSize.width, frameSize.height, e.what());
+    self->map->reset();
+    self->chroma->reset();
+    return FALSE;
+  }
+  if (!*self->map) {
+    GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND, ("Can't build the map for %dx%d frames", frameSize.width, frameSize.height),
+                      ("the remap table is %s and fits %dx%d", remapPath().c_str(), THETA_FRAME.width, THETA_FRAME.height));
+    return FALSE;
+  }
+  const dewarp_map &map = **self->map;
+  if (map.xy.cols != GST_VIDEO_INFO_WIDTH(out_info) || map.xy.rows != GST_VIDEO_INFO_HEIGHT(out_info)) {
+    GST_ERROR_OBJECT(self, "output caps are not the size of the view");
+    return FALSE;
+  }
+  if (GST_VIDEO_INFO_FORMAT(in_info) == GST_VIDEO_FORMAT_I420 && !*self->chroma) {
+    GST_ERROR_OBJECT(self, "can't build the chroma map");
+    return FALSE;
+  }
+  GST_INFO_OBJECT(self, "dewarping %dx%d to %dx%d", frameSize.width, frameSize.height, map.xy.cols, map.xy.rows);
+  return TRUE;
+}
+
+// the frames are GStreamer's own buffers, the mats only point into them
+static GstFlowReturn gst_theta_dewarp_transform_frame(GstVideoFilter *filter, GstVideoFrame *in, GstVideoFrame *out)
+{
+  GstThetaDewarp *self = GST_THETA_DEWARP(filter);
+  guint planes = GST_VIDEO_FRAME_N_PLANES(in);
+  for (guint i = 0; i < planes; i++) {
+    int type = planes == 1 ? CV_8UC3 : CV_8UC1;
+    cv::Mat src(GST_VIDEO_FRAME_COMP_HEIGHT(in, i), GST_VIDEO_FRAME_COMP_WIDTH(in, i), type,
+                GST_VIDEO_FRAME_PLANE_DATA(in, i), GST_VIDEO_FRAME_PLANE_STRIDE(in, i));
+    cv::Mat dst(GST_VIDEO_FRAME_COMP_HEIGHT(out, i), GST_VIDEO_FRAME_COMP_WIDTH(out, i), type,
+                GST_VIDEO_FRAME_PLANE_DATA(out, i), GST_VIDEO_FRAME_PLANE_STRIDE(out, i));
+    try {
+      dewarp(src, i == 0 ? **self->map : **self->chroma, dst);
+    }
+    catch (const cv::Exception &e) {
+      GST_ELEMENT_ERROR(self, STREAM, FAILED, ("Can't dewarp the frame"), ("%s", e.what()));
+      return GST_FLOW_ERROR;
+    }
+  }
+  return GST_FLOW_OK;
+}
+
+static void gst_theta_dewarp_class_init(GstThetaDewarpClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+  GstBaseTransformClass *transform_class = GST_BASE_TRANSFORM_CLASS(klass);
+  GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+  gobject_class->set_property = gst_theta_dewarp_set_property;
+  gobject_class->get_property = gst_theta_dewarp_get_property;
+  gobject_class->finalize = gst_theta_dewarp_finalize;
+  g_object_class_install_property(gobject_class, PROP_WIDTH,
+      g_param_spec_int("width", "Width", "Output width, 0 for the 1144x592 panorama of the remap tables or a 640 wide viewport",
+                       0, 8192, 0, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property(gobject_class, PROP_YAW,
+      g_param_spec_float("yaw", "Yaw", "Degrees the viewport looks right of the panorama's center",
+                         -180.0f, 180.0f, 0.0f, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property(gobject_class, PROP_PITCH,
+      g_param_spec_float("pitch", "Pitch", "Degrees the viewport looks up",
+                         -90.0f, 90.0f, 0.0f, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property(gobject_class, PROP_FOV,
+      g_param_spec_float("fov", "Field of view", "Degrees across the viewport, 0 for the whole panorama",
+                         0.0f, 170.0f, 0.0f, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  gst_element_class_set_static_metadata(element_class, "Ricoh THETA dewarp", "Filter/Effect/Video",
+                                        "Dewarps the dual fisheye frames of a Ricoh THETA S into a panorama", "RicohServer");
+  gst_element_class_add_static_pad_template(element_class, &sink_template);
+  gst_element_class_add_static_pad_template(element_class, &src_template);
+
+  transform_class->transform_caps = gst_theta_dewarp_transform_caps;
+  transform_class->passthrough_on_same_caps = FALSE;
+  filter_class->set_info = gst_theta_dewarp_set_info;
+  filter_class->transform_frame = gst_theta_dewarp_transform_frame;
+}
+
+static void gst_theta_dewarp_init(GstThetaDewarp *self)
+{
+  // GObject does not run constructors, so the C++ members live on the heap
+  self->view = new dewarp_view();
+  self->map = new std::shared_ptr<const dewarp_map>();
+  self->chroma = new std::shared_ptr<const dewarp_map>();
+}
+
+gboolean gst_theta_dewarp_register(GstPlugin *plugin)
+{
+  GST_DEBUG_CATEGORY_INIT(theta_dewarp_debug, "thetadewarp", 0, "Ricoh THETA dewarp");
+  return gst_element_register(plugin, "thetadewarp", GST_RANK_NONE, GST_TYPE_THETA_DEWARP);
+}
+
+#ifdef THETADEWARP_PLUGIN
+// built as a plugin of its own, so gst-launch-1.0 can find it through GST_PLUGIN_PATH
+#define PACKAGE "thetadewarp"
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR, GST_VERSION_MINOR, thetadewarp, "Ricoh THETA dual fisheye dewarp",
+                  gst_theta_dewarp_register, "1.0", "GPL", "RicohServer", "RicohServer")
+#endif
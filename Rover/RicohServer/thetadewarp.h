@@ -0,0 +1,39 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+#include "dewarp.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_THETA_DEWARP (gst_theta_dewarp_get_type())
+#define GST_THETA_DEWARP(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_THETA_DEWARP, GstThetaDewarp))
+
+/*
+   thetadewarp turns the dual fisheye frames of the Ricoh THETA S into the
+   panorama, or a viewport of it when fov is set, in the pipeline. It takes BGR,
+   RGB or I420, and gives the same format at viewSize, so nothing gets
+   converted or copied out of GStreamer's buffers.
+
+   gst-launch-1.0 videotestsrc ! video/x-raw, format=I420, width=1280, height=720 ! thetadewarp width=640 ! autovideosink
+ */
+typedef struct _GstThetaDewarp
+{
+  GstVideoFilter parent;
+  dewarp_view *view;                         // properties, changes renegotiate
+  std::shared_ptr<const dewarp_map> *map;    // packed pixels or the Y plane
+  std::shared_ptr<const dewarp_map> *chroma; // U and V planes of I420
+} GstThetaDewarp;
+
+typedef struct _GstThetaDewarpClass
+{
+  GstVideoFilterClass parent_class;
+} GstThetaDewarpClass;
+
+GType gst_theta_dewarp_get_type(void);
+
+// registers thetadewarp with a plugin, or with just this process for NULL
+gboolean gst_theta_dewarp_register(GstPlugin *plugin);
+
+G_END_DECLS
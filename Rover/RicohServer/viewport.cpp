@@ -0,0 +1,153 @@
+#include <string.h>
+#include <math.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+#include "viewport.h"
+#include "dewarp.h"
+#include "encoder.h"
+#include "timestamp.h"
+
+// a media factory that builds the pipeline for the view in the url
+typedef struct _ViewportFactory
+{
+  GstRTSPMediaFactory parent;
+  gchar *channel;
+} ViewportFactory;
+
+typedef struct _ViewportFactoryClass
+{
+  GstRTSPMediaFactoryClass parent_class;
+} ViewportFactoryClass;
+
+G_DEFINE_TYPE(ViewportFactory, viewport_factory, GST_TYPE_RTSP_MEDIA_FACTORY);
+
+/*
+   The view a url asks for. /view is a viewport, 90 degrees across and 640 wide
+   unless the query says otherwise, and /pano is the whole panorama. Angles are
+   rounded to a tenth of a degree, views closer than that are the same view.
+ */
+static dewarp_view parseView(const GstRTSPUrl *url)
+{
+  dewarp_view view;
+  gboolean viewport = g_str_has_suffix(url->abspath, "/view");
+  if (viewport) {
+    view.width = 640;
+    view.fov = 90.0f;
+  }
+
+  gchar **params = g_strsplit(url->query ? url->query : "", "&", -1);
+  for (gchar **param = params; *param; param++) {
+    gchar **pair = g_strsplit(*param, "=", 2);
+    if (pair[0] && pair[1]) {
+      float value = g_ascii_strtod(pair[1], NULL);
+      if (strcmp(pair[0], "width") == 0) {
+        view.width = value;
+      }
+      else if (viewport && strcmp(pair[0], "yaw") == 0) {
+        view.yaw = value;
+      }
+      else if (viewport && strcmp(pair[0], "pitch") == 0) {
+        view.pitch = value;
+      }
+      else if (viewport && strcmp(pair[0], "fov") == 0) {
+        view.fov = value;
+      }
+    }
+    g_strfreev(pair);
+  }
+  g_strfreev(params);
+
+  if (viewport) {
+    view.width = CLAMP(view.width, 64, 1920);
+    view.yaw = roundf(remainderf(view.yaw, 360.0f) * 10.0f) / 10.0f;
+    view.pitch = roundf(CLAMP(view.pitch, -90.0f, 90.0f) * 10.0f) / 10.0f;
+    view.fov = roundf(CLAMP(view.fov, 10.0f, 170.0f) * 10.0f) / 10.0f;
+  }
+  else {
+    view.width = CLAMP(view.width, 0, 4096);
+  }
+  return view;
+}
+
+// clients with the same key share a media, so the same view is dewarped once
+static gchar *viewport_factory_gen_key(GstRTSPMediaFactory *factory, const GstRTSPUrl *url)
+{
+  dewarp_view view = parseView(url);
+  return g_strdup_printf("%s %d %d %d %d", url->abspath, view.width,
+                         (int)lroundf(view.yaw * 10), (int)lroundf(view.pitch * 10), (int)lroundf(view.fov * 10));
+}
+
+static GstElement *viewport_factory_create_element(GstRTSPMediaFactory *factory, const GstRTSPUrl *url)
+{
+  ViewportFactory *self = (ViewportFactory *)factory;
+  dewarp_view view = parseView(url);
+  // the bitrate follows the size of the view, like the dewarp does
+  cv::Size size = viewSize(view);
+  std::string encoder = encoder_rtp(default_bitrate(size.width, size.height, 10), 10);
+  gchar *launch = g_strdup_printf("( intervideosrc channel=%s ! thetadewarp name=dewarp ! %s )",
+                                  self->channel, encoder.c_str());
+  GError *error = NULL;
+  GstElement *element = gst_parse_launch(launch, &error);
+  g_free(launch);
+  if (!element) {
+    g_printerr("can't make the ricoh view pipeline: %s\n", error ? error->message : "unknown error");
+    g_clear_error(&error);
+    return NULL;
+  }
+  g_clear_error(&error);
+
+  // set as properties, the launch string would depend on the locale for the decimals
+  GstElement *dewarp = gst_bin_get_by_name(GST_BIN(element), "dewarp");
+  g_object_set(G_OBJECT(dewarp), "width", view.width, "yaw", view.yaw, "pitch", view.pitch, "fov", view.fov, NULL);
+  gst_object_unref(dewarp);
+  GstElement *pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+  carry_capture(pay);
+  gst_object_unref(pay);
+  g_print("ricoh view %s: yaw %.1f pitch %.1f fov %.1f, %d wide\n", url->abspath, view.yaw, view.pitch, view.fov, view.width);
+  return element;
+}
+
+static void viewport_factory_finalize(GObject *object)
+{
+  g_free(((ViewportFactory *)object)->channel);
+  G_OBJECT_CLASS(viewport_factory_parent_class)->finalize(object);
+}
+
+static void viewport_factory_class_init(ViewportFactoryClass *klass)
+{
+  GstRTSPMediaFactoryClass *factory_class = GST_RTSP_MEDIA_FACTORY_CLASS(klass);
+  G_OBJECT_CLASS(klass)->finalize = viewport_factory_finalize;
+  factory_class->gen_key = viewport_factory_gen_key;
+  factory_class->create_element = viewport_factory_create_element;
+}
+
+static void viewport_factory_init(ViewportFactory *self)
+{
+  self->channel = NULL;
+}
+
+gboolean start_viewports(const char *port, const char *channel, demand *camera)
+{
+  GstRTSPServer *server = gst_rtsp_server_new();
+  g_object_set(server, "service", port, NULL);
+
+  GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(server);
+  const char *paths[] = { "/view", "/pano" };
+  for (const char *path : paths) {
+    ViewportFactory *factory = (ViewportFactory *)g_object_new(viewport_factory_get_type(), NULL);
+    factory->channel = g_strdup(channel);
+    gst_rtsp_media_factory_set_shared(GST_RTSP_MEDIA_FACTORY(factory), TRUE);
+    watch_factory(GST_RTSP_MEDIA_FACTORY(factory), camera);
+    gst_rtsp_mount_points_add_factory(mounts, path, GST_RTSP_MEDIA_FACTORY(factory));
+  }
+  g_object_unref(mounts);
+
+  // served from the main loop gserver runs once every camera is started
+  if (gst_rtsp_server_attach(server, NULL) == 0) {
+    g_printerr("can't start the ricoh view server on port %s\n", port);
+    g_object_unref(server);
+    return FALSE;
+  }
+  g_print("ricoh views ready at rtsp://127.0.0.1:%s/view?yaw=0&pitch=0&fov=90&width=640 and /pano\n", port);
+  return TRUE;
+}
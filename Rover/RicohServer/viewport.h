@@ -0,0 +1,21 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include "demand.h"
+
+#define RICOH_RTSP_PORT "8554"
+#define RICOH_CHANNEL "ricoh"
+
+/*
+   Serves views of the ricoh over RTSP, dewarped by thetadewarp from the raw
+   frames on an intervideo channel. Each client picks its view in the url:
+
+   rtsp://rover:8554/view?yaw=90&pitch=-20&fov=80&width=640
+   rtsp://rover:8554/pano?width=1024
+
+   Clients asking for the same view share one pipeline, and each pipeline only
+   dewarps the pixels of its view. camera runs while any view is watched.
+   Returns FALSE if the server can't start.
+ */
+gboolean start_viewports(const char *port, const char *channel, demand *camera);
@@ -0,0 +1,67 @@
+#ifndef CAPTURE_H_   /* Include guard */
+#define CAPTURE_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/core.hpp>
+
+// One grabbed camera frame. Copies share the pixel buffers, so every stage gets
+// the same frame without copying it. Treat the mats as read-only.
+struct frame
+{
+    cv::Mat bgr;                   // left image
+    cv::Mat depth;                 // CV_32FC1 depth in meters, a view into depth_buffer
+    std::shared_ptr<void> depth_buffer; // keeps the memory behind depth alive
+    cv::Mat xyz;                   // CV_32FC4 point cloud in meters, only in --mode=voxel
+    std::shared_ptr<void> xyz_buffer;   // keeps the memory behind xyz alive
+    uint64_t timestamp_ns = 0;     // capture time
+    uint64_t number = 0;           // counts up from 1, 0 means no frame yet
+};
+
+// Hands the newest frame from the capture thread to the threads that use it.
+// A consumer that falls behind skips to the newest frame instead of queueing.
+class frame_slot
+{
+public:
+    void
+    publish(const frame &f)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            latest = f;
+        }
+        cond.notify_all();
+    }
+
+    // blocks until a frame newer than number last is published, false once closed
+    bool
+    wait_newer(uint64_t last, frame &f)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        cond.wait(guard, [&] { return(closed || latest.number > last); });
+        if(closed)
+            return(false);
+        f = latest;
+        return(true);
+    }
+
+    void
+    close()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        cond.notify_all();
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable cond;
+    frame latest;
+    bool closed = false;
+};
+
+#endif // CAPTURE_H_
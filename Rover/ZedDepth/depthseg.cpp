@@ -0,0 +1,281 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "depthseg.h"
+#include "timing.h"
+
+// what a pixel is, links only join pixels of the same kind
+enum pixel_kind
+{
+    KIND_NONE = 0,   // no depth or out of range
+    KIND_GROUND = 1, // depth grows up the image
+    KIND_UPRIGHT = 2 // depth stays about the same up the image
+};
+
+// One row of pixel kinds. The slope is the central difference between the rows
+// above and below. Comparisons with NaN are false, so holes are KIND_NONE and
+// pixels next to holes are KIND_GROUND.
+static void
+kind_row(const float *depth, const float *up, const float *down, uchar *kind, int cols, const depth_segment_params &params)
+{
+    int x = 0;
+#if CV_SIMD
+    const cv::v_float32 v_zero = cv::vx_setzero_f32();
+    const cv::v_float32 v_max = cv::vx_setall_f32(params.max_range);
+    const cv::v_float32 v_slope = cv::vx_setall_f32(2.0f * params.upright_slope);
+    const cv::v_uint8 v_one = cv::vx_setall_u8(1);
+    constexpr int lanes = cv::v_float32::nlanes;
+    for(; x <= cols - 4 * lanes; x += 4 * lanes)
+    {
+        cv::v_uint32 valid[4], upright[4];
+        for(int k = 0; k < 4; k++)
+        {
+            int i = x + k * lanes;
+            cv::v_float32 d = cv::vx_load(depth + i);
+            valid[k] = cv::v_reinterpret_as_u32((d > v_zero) & (d <= v_max));
+            upright[k] = cv::v_reinterpret_as_u32(cv::v_abs(cv::vx_load(down + i) - cv::vx_load(up + i)) < v_slope * d);
+        }
+        cv::v_uint8 is_valid = cv::v_pack(cv::v_pack(valid[0], valid[1]), cv::v_pack(valid[2], valid[3]));
+        cv::v_uint8 is_upright = cv::v_pack(cv::v_pack(upright[0], upright[1]), cv::v_pack(upright[2], upright[3]));
+        cv::v_store(kind + x, (is_valid & v_one) + (is_valid & is_upright & v_one));
+    }
+#endif
+    for(; x < cols; x++)
+    {
+        float d = depth[x];
+        if(!(d > 0.0f && d <= params.max_range))
+            kind[x] = KIND_NONE;
+        else if(std::abs(down[x] - up[x]) < 2.0f * params.upright_slope * d)
+            kind[x] = KIND_UPRIGHT;
+        else
+            kind[x] = KIND_GROUND;
+    }
+}
+
+// Sets link[x] to 255 where pixel x of a joins pixel x of b, b being the next
+// column or the next row. They join when they are the same kind, not KIND_NONE,
+// and their depths are within max_step of each other.
+static void
+link_row(const float *a, const float *b, const uchar *kind_a, const uchar *kind_b, uchar *link, int n, float max_step)
+{
+    int x = 0;
+#if CV_SIMD
+    const cv::v_float32 v_step = cv::vx_setall_f32(max_step);
+    const cv::v_uint8 v_none = cv::vx_setzero_u8();
+    constexpr int lanes = cv::v_float32::nlanes;
+    for(; x <= n - 4 * lanes; x += 4 * lanes)
+    {
+        cv::v_uint32 near[4];
+        for(int k = 0; k < 4; k++)
+        {
+            int i = x + k * lanes;
+            cv::v_float32 da = cv::vx_load(a + i);
+            near[k] = cv::v_reinterpret_as_u32(cv::v_abs(cv::vx_load(b + i) - da) <= v_step * da);
+        }
+        cv::v_uint8 is_near = cv::v_pack(cv::v_pack(near[0], near[1]), cv::v_pack(near[2], near[3]));
+        cv::v_uint8 ka = cv::vx_load(kind_a + x);
+        cv::v_uint8 same = (ka == cv::vx_load(kind_b + x)) & (ka != v_none);
+        cv::v_store(link + x, is_near & same);
+    }
+#endif
+    for(; x < n; x++)
+    {
+        bool joined = kind_a[x] != KIND_NONE && kind_a[x] == kind_b[x] && std::abs(b[x] - a[x]) <= max_step * a[x];
+        link[x] = joined ? 255 : 0;
+    }
+}
+
+static int
+find_root(std::vector<int> &parent, int i)
+{
+    while(parent[i] != i)
+    {
+        parent[i] = parent[parent[i]]; // path halving
+        i = parent[i];
+    }
+    return(i);
+}
+
+void
+depth_components(const cv::Mat &depth,
+                 const depth_segment_params &params,
+                 cv::Mat &labels,
+                 std::vector<depth_component> &components)
+{
+    CV_Assert(depth.type() == CV_32FC1);
+    const int rows = depth.rows, cols = depth.cols;
+
+    // kinds and links are independent per row, so they run in parallel
+    cv::Mat kind(depth.size(), CV_8UC1), right(depth.size(), CV_8UC1), down(depth.size(), CV_8UC1);
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
+    {
+        for(int y = range.start; y < range.end; y++)
+        {
+            kind_row(depth.ptr<float>(y),
+                     depth.ptr<float>(std::max(y - 1, 0)),
+                     depth.ptr<float>(std::min(y + 1, rows - 1)),
+                     kind.ptr<uchar>(y),
+                     cols,
+                     params);
+        }
+    });
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
+    {
+        for(int y = range.start; y < range.end; y++)
+        {
+            const float *d = depth.ptr<float>(y);
+            const uchar *k = kind.ptr<uchar>(y);
+            link_row(d, d + 1, k, k + 1, right.ptr<uchar>(y), cols - 1, params.max_step);
+            right.ptr<uchar>(y)[cols - 1] = 0;
+            if(y + 1 < rows)
+                link_row(d, depth.ptr<float>(y + 1), k, kind.ptr<uchar>(y + 1), down.ptr<uchar>(y), cols, params.max_step);
+            else
+                memset(down.ptr<uchar>(y), 0, cols);
+        }
+    });
+
+    // one scan joining every pixel to its left and upper neighbour through union-find
+    labels.create(depth.size(), CV_32S);
+    std::vector<int> parent(1, 0);
+    for(int y = 0; y < rows; y++)
+    {
+        int *l = labels.ptr<int>(y);
+        const int *l_up = y > 0 ? labels.ptr<int>(y - 1) : nullptr;
+        const uchar *k = kind.ptr<uchar>(y);
+        const uchar *r = right.ptr<uchar>(y);
+        const uchar *d_up = y > 0 ? down.ptr<uchar>(y - 1) : nullptr;
+        for(int x = 0; x < cols; x++)
+        {
+            if(k[x] == KIND_NONE)
+            {
+                l[x] = 0;
+                continue;
+            }
+            int label = x > 0 && r[x - 1] ? l[x - 1] : 0;
+            if(d_up && d_up[x])
+            {
+                if(!label)
+                {
+                    label = l_up[x];
+                }
+                else if(l_up[x] != label)
+                {
+                    int a = find_root(parent, label), b = find_root(parent, l_up[x]);
+                    if(a != b)
+                        parent[std::max(a, b)] = std::min(a, b);
+                }
+            }
+            if(!label)
+            {
+                label = parent.size();
+                parent.push_back(label);
+            }
+            l[x] = label;
+        }
+    }
+
+    // roots always have the smallest label in their set, so they get numbered first
+    std::vector<int> final_label(parent.size(), 0);
+    int count = 0;
+    for(int i = 1; i < (int) parent.size(); i++)
+    {
+        int root = find_root(parent, i);
+        final_label[i] = root == i ? ++count : final_label[root];
+    }
+
+    depth_component empty = { cv::Rect(), 0, INFINITY, 0.0f, 0.0f, false };
+    components.assign(count + 1, empty);
+    std::vector<cv::Point> top_left(count + 1, cv::Point(INT_MAX, INT_MAX));
+    std::vector<cv::Point> bottom_right(count + 1, cv::Point(-1, -1));
+    std::vector<double> sum(count + 1, 0.0);
+    for(int y = 0; y < rows; y++)
+    {
+        int *l = labels.ptr<int>(y);
+        const float *d = depth.ptr<float>(y);
+        const uchar *k = kind.ptr<uchar>(y);
+        for(int x = 0; x < cols; x++)
+        {
+            if(!l[x])
+                continue;
+            int c = l[x] = final_label[l[x]];
+            depth_component &comp = components[c];
+            comp.area++;
+            comp.nearest = std::min(comp.nearest, d[x]);
+            comp.farthest = std::max(comp.farthest, d[x]);
+            comp.upright = k[x] == KIND_UPRIGHT;
+            sum[c] += d[x];
+            top_left[c].x = std::min(top_left[c].x, x);
+            top_left[c].y = std::min(top_left[c].y, y);
+            bottom_right[c].x = std::max(bottom_right[c].x, x);
+            bottom_right[c].y = std::max(bottom_right[c].y, y);
+        }
+    }
+    for(int c = 1; c <= count; c++)
+    {
+        components[c].rect = cv::Rect(top_left[c], bottom_right[c] + cv::Point(1, 1));
+        components[c].mean = sum[c] / components[c].area;
+    }
+}
+
+void
+segment_depth(const cv::Mat &depth,
+              const depth_segment_params &params,
+              std::vector<obstacle> &obstacles,
+              cv::Mat &markers,
+              cv::Mat *view)
+{
+    auto start = NOW;
+    std::vector<depth_component> components;
+    depth_components(depth, params, markers, components);
+    auto end = NOW;
+    auto ms = TIME;
+    std::cout << "Components Time: " << ms << " ms, " << components.size() - 1 << " components\n";
+
+    start = NOW;
+    obstacles.clear();
+    std::vector<bool> is_obstacle(components.size(), false);
+    for(int c = 1; c < (int) components.size(); c++)
+    {
+        const depth_component &comp = components[c];
+        is_obstacle[c] = comp.upright && params.min_area <= comp.area && comp.area <= params.max_area;
+        if(is_obstacle[c])
+            obstacles.push_back({ comp.rect, comp.nearest, comp.area, c });
+    }
+    end = NOW;
+    ms = TIME;
+    std::cout << "Obstacles Time: " << ms << " ms\n";
+
+    if(!view)
+        return;
+
+    start = NOW;
+    // obstacles in shades of green, the rest of the upright components gray and the ground blue
+    std::vector<cv::Vec3b> colors(components.size(), cv::Vec3b(0, 0, 0));
+    for(int c = 1; c < (int) components.size(); c++)
+    {
+        if(is_obstacle[c])
+            colors[c] = cv::Vec3b(0, 64 + rand() % 192, 0);
+        else if(components[c].upright)
+            colors[c] = cv::Vec3b(96, 96, 96);
+        else
+            colors[c] = cv::Vec3b(96, 0, 0);
+    }
+    view->create(markers.size(), CV_8UC3);
+    for(int i = 0; i < markers.rows; i++)
+    {
+        const int *label = markers.ptr<int>(i);
+        cv::Vec3b *out = view->ptr<cv::Vec3b>(i);
+        for(int j = 0; j < markers.cols; j++)
+            out[j] = colors[label[j]];
+    }
+    draw_obstacles(*view, obstacles);
+    end = NOW;
+    ms = TIME;
+    std::cout << "Coloring Time: " << ms << " ms\n";
+}
@@ -0,0 +1,49 @@
+#ifndef DEPTHSEG_H_   /* Include guard */
+#define DEPTHSEG_H_
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include "obstacle.h"
+
+// tuning for segmenting the depth map on its own
+struct depth_segment_params
+{
+    float max_step = 0.03f;      // neighbours whose depths differ by more than this fraction are split
+    float upright_slope = 0.01f; // pixels whose depth changes less than this fraction per row face the camera
+    float max_range = 6.0f;      // meters
+    int min_area = 2000;         // smaller components are noise, in pixels
+    int max_area = 200000;
+};
+
+// One connected component of the depth map
+struct depth_component
+{
+    cv::Rect rect;
+    int area;
+    float nearest;  // meters
+    float farthest;
+    float mean;
+    bool upright;   // faces the camera, ground and anything else that recedes with height is not
+};
+
+// Labels the depth map into connected components. Neighbours are joined when both
+// have depth in range, their depths are within max_step of each other, and both
+// are upright or both are not. The last rule cuts obstacles off the ground they
+// stand on, where the depths meet. labels gets CV_32S labels from 1, 0 where the
+// depth is invalid, and components is indexed by label with entry 0 unused.
+void depth_components(const cv::Mat &depth,
+                      const depth_segment_params &params,
+                      cv::Mat &labels,
+                      std::vector<depth_component> &components);
+
+// Obstacles are upright components of a sensible size, with their nearest depth
+// as distance. markers gets the labels, obstacle ids are labels in it, so the
+// tracker can take its masks from it like from the watershed. If view is given it
+// gets the colored components for debugging.
+void segment_depth(const cv::Mat &depth,
+                   const depth_segment_params &params,
+                   std::vector<obstacle> &obstacles,
+                   cv::Mat &markers,
+                   cv::Mat *view = nullptr);
+
+#endif // DEPTHSEG_H_
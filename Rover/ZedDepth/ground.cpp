@@ -0,0 +1,314 @@
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "ground.h"
+
+// header at the start of a ground model file. Version 1 is followed by the mean
+// only, version 2 by the mean, m2 and count images, each rows * cols floats.
+struct ground_header
+{
+    char magic[4];
+    uint32_t version;
+    int32_t rows;
+    int32_t cols;
+};
+
+static const char ground_magic[4] = { 'Z', 'G', 'N', 'D' };
+static const uint32_t ground_version = 2;
+
+// write row by row in case the mat has padding
+static void
+write_floats(std::ofstream &out, const cv::Mat &m)
+{
+    for(int i = 0; i < m.rows; i++)
+        out.write(m.ptr<char>(i), m.cols * sizeof(float));
+}
+
+void
+ground_model::reset(cv::Size size)
+{
+    mean = cv::Mat::zeros(size, CV_32FC1);
+    m2 = cv::Mat::zeros(size, CV_32FC1);
+    count = cv::Mat::zeros(size, CV_32FC1);
+}
+
+void
+ground_model::resize(cv::Size size)
+{
+    cv::resize(mean, mean, size, 0, 0, cv::INTER_NEAREST);
+    cv::resize(m2, m2, size, 0, 0, cv::INTER_NEAREST);
+    cv::resize(count, count, size, 0, 0, cv::INTER_NEAREST);
+}
+
+bool
+ground_model::save(const std::string &path) const
+{
+    // write next to the old model and swap it in, so a crash never leaves half a file
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    if(!out)
+        return(false);
+
+    ground_header header;
+    memcpy(header.magic, ground_magic, sizeof(header.magic));
+    header.version = ground_version;
+    header.rows = mean.rows;
+    header.cols = mean.cols;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    write_floats(out, mean);
+    write_floats(out, m2);
+    write_floats(out, count);
+    out.close();
+    return(out.good() && rename(tmp.c_str(), path.c_str()) == 0);
+}
+
+bool
+ground_model::load(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if(!in)
+        return(false);
+
+    ground_header header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if(!in
+       || memcmp(header.magic, ground_magic, sizeof(header.magic)) != 0
+       || (header.version != 1 && header.version != ground_version)
+       || header.rows <= 0
+       || header.cols <= 0)
+        return(false);
+
+    reset(cv::Size(header.cols, header.rows));
+    size_t bytes = mean.total() * sizeof(float);
+    in.read(mean.ptr<char>(), bytes);
+    if(header.version == 1)
+    {
+        // save-depth used to average 10 frames, NaN included
+        constexpr float v1_count = 10.0f;
+        cv::Mat valid = mean == mean;
+        count.setTo(v1_count, valid);
+        mean.setTo(0.0f, ~valid);
+    }
+    else
+    {
+        in.read(m2.ptr<char>(), bytes);
+        in.read(count.ptr<char>(), bytes);
+    }
+    return(in.good());
+}
+
+// One row of the Welford update. A sample is used only where depth is finite and
+// skip is zero. Once count reaches max_count, m2 is faded by (n - 1) / n so the
+// variance m2 / n stays a running estimate instead of growing forever.
+static void
+update_row(const float *depth, const uchar *skip, float *mean, float *m2, float *count, int cols, float max_count)
+{
+    int x = 0;
+#if CV_SIMD
+    const cv::v_float32 v_zero = cv::vx_setzero_f32();
+    const cv::v_float32 v_one = cv::vx_setall_f32(1.0f);
+    const cv::v_float32 v_inf = cv::vx_setall_f32(INFINITY);
+    const cv::v_float32 v_max_count = cv::vx_setall_f32(max_count);
+    const cv::v_float32 v_fade = cv::vx_setall_f32((max_count - 1.0f) / max_count);
+    const cv::v_uint32 v_zero_u32 = cv::vx_setzero_u32();
+    constexpr int lanes = cv::v_float32::nlanes;
+    // one vector of skip bytes covers four vectors of floats
+    for(; x <= cols - 4 * lanes; x += 4 * lanes)
+    {
+        cv::v_uint32 keep[4];
+        if(skip)
+        {
+            cv::v_uint16 s0, s1;
+            cv::v_expand(cv::vx_load(skip + x), s0, s1);
+            cv::v_expand(s0, keep[0], keep[1]);
+            cv::v_expand(s1, keep[2], keep[3]);
+            for(int k = 0; k < 4; k++)
+                keep[k] = keep[k] == v_zero_u32;
+        }
+        else
+        {
+            for(int k = 0; k < 4; k++)
+                keep[k] = v_zero_u32 == v_zero_u32;
+        }
+
+        for(int k = 0; k < 4; k++)
+        {
+            int i = x + k * lanes;
+            cv::v_float32 d = cv::vx_load(depth + i);
+            cv::v_float32 n = cv::vx_load(count + i);
+            cv::v_float32 mu = cv::vx_load(mean + i);
+            cv::v_float32 s = cv::vx_load(m2 + i);
+            // comparisons with NaN are false, so holes drop out here
+            cv::v_float32 valid = (d > v_zero) & (d < v_inf) & cv::v_reinterpret_as_f32(keep[k]);
+
+            cv::v_float32 n1 = cv::v_min(n + v_one, v_max_count);
+            cv::v_float32 delta = d - mu;
+            cv::v_float32 mu1 = mu + delta / n1;
+            cv::v_float32 fade = cv::v_select(n >= v_max_count, v_fade, v_one);
+            cv::v_float32 s1 = s * fade + delta * (d - mu1);
+
+            cv::v_store(count + i, cv::v_select(valid, n1, n));
+            cv::v_store(mean + i, cv::v_select(valid, mu1, mu));
+            cv::v_store(m2 + i, cv::v_select(valid, s1, s));
+        }
+    }
+#endif
+    for(; x < cols; x++)
+    {
+        float d = depth[x];
+        if(!(d > 0.0f && d < INFINITY) || (skip && skip[x]))
+            continue;
+        float n1 = std::min(count[x] + 1.0f, max_count);
+        float fade = count[x] >= max_count ? (max_count - 1.0f) / max_count : 1.0f;
+        float delta = d - mean[x];
+        mean[x] += delta / n1;
+        m2[x] = m2[x] * fade + delta * (d - mean[x]);
+        count[x] = n1;
+    }
+}
+
+void
+ground_model::update(const cv::Mat &depth, int max_count, const cv::Mat &skip)
+{
+    CV_Assert(depth.type() == CV_32FC1);
+    CV_Assert(skip.empty() || (skip.type() == CV_8UC1 && skip.size() == depth.size()));
+    if(mean.size() != depth.size())
+        reset(depth.size());
+
+    cv::parallel_for_(cv::Range(0, depth.rows), [&](const cv::Range &range)
+    {
+        for(int i = range.start; i < range.end; i++)
+        {
+            update_row(depth.ptr<float>(i),
+                       skip.empty() ? nullptr : skip.ptr<uchar>(i),
+                       mean.ptr<float>(i),
+                       m2.ptr<float>(i),
+                       count.ptr<float>(i),
+                       depth.cols,
+                       (float) max_count);
+        }
+    });
+}
+
+// One row of the above ground test. The threshold is the larger of the fixed one
+// and noise_k standard deviations of the pixel. Comparisons against NaN are
+// always false, so pixels without valid depth never count as obstacle.
+static void
+above_ground_row(const float *depth,
+                 const float *mean,
+                 const float *m2,
+                 const float *count,
+                 uchar *mask,
+                 int cols,
+                 const ground_params &params)
+{
+    int x = 0;
+#if CV_SIMD
+    const cv::v_float32 v_threshold = cv::vx_setall_f32(params.threshold);
+    const cv::v_float32 v_k = cv::vx_setall_f32(params.noise_k);
+    const cv::v_float32 v_max = cv::vx_setall_f32(params.max_range);
+    const cv::v_float32 v_min_count = cv::vx_setall_f32(params.min_count);
+    const cv::v_float32 v_zero = cv::vx_setzero_f32();
+    constexpr int lanes = cv::v_float32::nlanes;
+    // four float vectors pack down into one full vector of mask bytes
+    for(; x <= cols - 4 * lanes; x += 4 * lanes)
+    {
+        cv::v_uint32 hit[4];
+        for(int k = 0; k < 4; k++)
+        {
+            int i = x + k * lanes;
+            cv::v_float32 d = cv::vx_load(depth + i);
+            cv::v_float32 n = cv::vx_load(count + i);
+            cv::v_float32 thr = cv::v_max(v_threshold, v_k * cv::v_sqrt(cv::vx_load(m2 + i) / n));
+            hit[k] = cv::v_reinterpret_as_u32((d > v_zero)
+                                              & (d <= v_max)
+                                              & (n >= v_min_count)
+                                              & ((cv::vx_load(mean + i) - d) > thr));
+        }
+        cv::v_store(mask + x, cv::v_pack(cv::v_pack(hit[0], hit[1]), cv::v_pack(hit[2], hit[3])));
+    }
+#endif
+    for(; x < cols; x++)
+    {
+        float d = depth[x];
+        bool hit = false;
+        if(count[x] >= params.min_count)
+        {
+            float thr = std::max(params.threshold, params.noise_k * std::sqrt(m2[x] / count[x]));
+            hit = d > 0.0f && d <= params.max_range && mean[x] - d > thr;
+        }
+        mask[x] = hit ? 255 : 0;
+    }
+}
+
+void
+above_ground_mask(const cv::Mat &depth, const ground_model &ground, const ground_params &params, cv::Mat &mask)
+{
+    CV_Assert(depth.type() == CV_32FC1 && depth.size() == ground.size());
+
+    mask.create(depth.size(), CV_8UC1);
+    cv::parallel_for_(cv::Range(0, depth.rows), [&](const cv::Range &range)
+    {
+        for(int i = range.start; i < range.end; i++)
+        {
+            above_ground_row(depth.ptr<float>(i),
+                             ground.mean.ptr<float>(i),
+                             ground.m2.ptr<float>(i),
+                             ground.count.ptr<float>(i),
+                             mask.ptr<uchar>(i),
+                             depth.cols,
+                             params);
+        }
+    });
+}
+
+void
+find_ground_obstacles(const cv::Mat &depth,
+                      const ground_model &ground,
+                      const ground_params &params,
+                      std::vector<obstacle> &obstacles,
+                      cv::Mat &mask)
+{
+    above_ground_mask(depth, ground, params, mask);
+
+    // knock out single pixel depth speckle before labelling
+    cv::morphologyEx(mask, mask, cv::MORPH_OPEN, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+
+    cv::Mat labels, stats, centroids;
+    int count = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+
+    // nearest depth of every blob, every labelled pixel has valid depth
+    std::vector<float> nearest(count, INFINITY);
+    for(int i = 0; i < labels.rows; i++)
+    {
+        const int *label = labels.ptr<int>(i);
+        const float *d = depth.ptr<float>(i);
+        for(int j = 0; j < labels.cols; j++)
+            if(label[j] > 0 && d[j] < nearest[label[j]])
+                nearest[label[j]] = d[j];
+    }
+
+    obstacles.clear();
+    for(int i = 1; i < count; i++) // label 0 is the background
+    {
+        int area = stats.at<int>(i, cv::CC_STAT_AREA);
+        if(area < params.min_area)
+            continue;
+
+        obstacle o;
+        o.rect = cv::Rect(stats.at<int>(i, cv::CC_STAT_LEFT),
+                          stats.at<int>(i, cv::CC_STAT_TOP),
+                          stats.at<int>(i, cv::CC_STAT_WIDTH),
+                          stats.at<int>(i, cv::CC_STAT_HEIGHT));
+        o.distance = nearest[i];
+        o.area = area;
+        o.id = i;
+        obstacles.push_back(o);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef GROUND_H_   /* Include guard */
+#define GROUND_H_
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "obstacle.h"
+
+// tuning for the ground subtraction detector
+struct ground_params
+{
+    float threshold = 0.15f; // least meters closer than the ground before a pixel counts as obstacle
+    float noise_k = 3.0f;    // noisy pixels need to be this many standard deviations closer instead
+    float max_range = 6.0f;  // anything further away than this is ignored
+    int min_area = 400;      // blobs with fewer pixels than this are treated as noise
+    int min_count = 10;      // pixels seen fewer times than this are not judged yet
+    int max_count = 300;     // frames the model remembers, older frames fade out
+};
+
+// Per-pixel running mean and variance of the ground depth, updated with Welford's
+// method. Depth that is NaN or inf is skipped per pixel so holes never spread into
+// the model. Once a pixel has max_count samples the oldest ones fade out, so the
+// model follows slow changes like the rover tilting on a slope.
+class ground_model
+{
+public:
+    void reset(cv::Size size);
+    bool empty() const { return(mean.empty()); }
+    cv::Size size() const { return(mean.size()); }
+
+    // adds one depth frame, skipping pixels where skip is nonzero
+    void update(const cv::Mat &depth, int max_count, const cv::Mat &skip = cv::Mat());
+
+    // rescales a model recorded at another resolution
+    void resize(cv::Size size);
+
+    // raw floats behind a small header, loads with one read per image
+    bool save(const std::string &path) const;
+    bool load(const std::string &path);
+
+    cv::Mat mean;  // CV_32FC1 meters
+    cv::Mat m2;    // CV_32FC1 sum of squared differences from the mean
+    cv::Mat count; // CV_32FC1 samples per pixel
+};
+
+// sets mask to 255 wherever depth is closer than the ground by more than the
+// pixel's threshold, which grows with the noise the model has seen at that pixel
+void above_ground_mask(const cv::Mat &depth, const ground_model &ground, const ground_params &params, cv::Mat &mask);
+
+// finds obstacles as connected blobs of pixels that rise above the ground model
+void find_ground_obstacles(const cv::Mat &depth,
+                           const ground_model &ground,
+                           const ground_params &params,
+                           std::vector<obstacle> &obstacles,
+                           cv::Mat &mask);
+
+#endif // GROUND_H_
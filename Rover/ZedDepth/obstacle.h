@@ -0,0 +1,37 @@
+#ifndef OBSTACLE_H_   /* Include guard */
+#define OBSTACLE_H_
+
+#include <vector>
+#include <sstream>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+// an obstacle found by one of the detection modes, in image coordinates
+struct obstacle
+{
+    cv::Rect rect;   // bounding box in pixels
+    float distance;  // depth of the obstacle in meters
+    int area;        // number of pixels that belong to the obstacle
+    int id;          // label of the segment or blob, or the track id once tracked
+};
+
+// draws a red box and the distance of every obstacle onto a BGR image
+inline void
+draw_obstacles(cv::Mat &img, const std::vector<obstacle> &obstacles)
+{
+    constexpr int thickness = 6;
+    for(const obstacle &o : obstacles)
+    {
+        cv::rectangle(img, o.rect, cv::Scalar(0, 0, 255), thickness);
+        std::ostringstream ss;
+        ss << o.distance << " meters";
+        cv::putText(img,
+                    ss.str(),
+                    cv::Point(o.rect.x + thickness, o.rect.y + o.rect.height - thickness),
+                    cv::FONT_HERSHEY_SIMPLEX,
+                    0.4,
+                    cv::Scalar(0, 255, 0));
+    }
+}
+
+#endif // OBSTACLE_H_
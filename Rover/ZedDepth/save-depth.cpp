@@ -6,6 +6,8 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d.hpp>
 #include <sl/Camera.hpp>
+#include "ground.h"
+#include "voxel.h"
 
 cv::Mat slMat2cvMat(const sl::Mat &input)
 {
@@ -32,7 +34,8 @@ cv::Mat slMat2cvMat(const sl::Mat &input)
 int main(void)
 {
     sl::InitParameters init_params;
-    init_params.camera_resolution = sl::RESOLUTION_HD1080;
+    // must match zed-depth so the ground model lines up with its depth
+    init_params.camera_resolution = sl::RESOLUTION_VGA;
     init_params.depth_mode = sl::DEPTH_MODE_QUALITY;
     init_params.coordinate_units = sl::UNIT_METER;
 
@@ -46,53 +49,41 @@ int main(void)
     sl::RuntimeParameters runtime_params;
     runtime_params.sensing_mode = sl::SENSING_MODE_STANDARD;
     runtime_params.enable_point_cloud = false;
-    sl::Resolution image_size = zed.getResolution();
-    int32_t new_width = image_size.width / 2;
-    int32_t new_height = image_size.height / 2;
-
-    sl::Mat img_zed(new_width, new_height, sl::MAT_TYPE_8U_C4);
-    cv::Mat image_cv = slMat2cvMat(img_zed);
-
-    sl::Mat depth_img_zed(new_width, new_height, sl::MAT_TYPE_8U_C4);
-    cv::Mat depth_img_cv = slMat2cvMat(depth_img_zed);
 
+    // zed-depth keeps refining the model, this only gives it a clean start
+    constexpr int num_pics = 100;
+    ground_params params;
+    ground_model ground;
     sl::Mat sl_depth_f32;
-    cv::Mat cv_depth_f32;
-
-    constexpr int num_pics = 10;    
-    
-    if(zed.grab(runtime_params) == sl::SUCCESS)
-    {
-        zed.retrieveImage(img_zed, sl::VIEW_LEFT, sl::MEM_CPU, new_width, new_height);
-        zed.retrieveImage(depth_img_zed, sl::VIEW_DEPTH, sl::MEM_CPU, new_width, new_height);
-        zed.retrieveMeasure(sl_depth_f32, sl::MEASURE_DEPTH);
-        cv::Mat tmp = slMat2cvMat(sl_depth_f32);
-        cv_depth_f32 = tmp;
-        std::cout << "Frame 1" << std::endl;
-    }
-    else
-    {
-        std::cout << "Failed to grab frame" << std::endl;
-    }
-    for(int i = 0; i < num_pics - 1; i++)
+    for(int i = 0; i < num_pics; i++)
     {
         if(zed.grab(runtime_params) == sl::SUCCESS)
         {
-            zed.retrieveImage(img_zed, sl::VIEW_LEFT, sl::MEM_CPU, new_width, new_height);
-            zed.retrieveImage(depth_img_zed, sl::VIEW_DEPTH, sl::MEM_CPU, new_width, new_height);
             zed.retrieveMeasure(sl_depth_f32, sl::MEASURE_DEPTH);
-            cv::Mat this_cv_depth_f32 = slMat2cvMat(sl_depth_f32);
-            cv_depth_f32 += this_cv_depth_f32;
+            // holes are skipped per pixel, so one NaN no longer spoils the average
+            ground.update(slMat2cvMat(sl_depth_f32), params.max_count);
             std::cout << "Frame " << (i + 1) << std::endl;
         }
         else
         {
             std::cout << "Failed to grab frame.\n";
         }
-        cv::waitKey(100);
     }
-    cv_depth_f32 /= num_pics;
-    imwrite("ground.png", cv_depth_f32);
+
+    if(ground.empty() || !ground.save("ground.bin"))
+    {
+        std::cout << "Failed to write ground.bin\n";
+    }
+
+    // one point cloud to try test-voxel on
+    runtime_params.enable_point_cloud = true;
+    sl::Mat sl_xyz;
+    if(zed.grab(runtime_params) != sl::SUCCESS
+       || zed.retrieveMeasure(sl_xyz, sl::MEASURE_XYZ) != sl::SUCCESS
+       || !save_cloud("cloud.bin", sl_xyz.getPtr<sl::float1>(sl::MEM_CPU), sl_xyz.getWidth(), sl_xyz.getHeight(), sl_xyz.getStepBytes(sl::MEM_CPU) / sizeof(float)))
+    {
+        std::cout << "Failed to write cloud.bin\n";
+    }
     zed.close();
     return(0);
 }
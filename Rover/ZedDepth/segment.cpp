@@ -0,0 +1,295 @@
+#include <iostream>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+
+#include "segment.h"
+#include "timing.h"
+
+// nearest depth under mask, 0 if it has none. Comparisons with NaN are false so
+// holes are skipped. The coarse level already dropped segments out of range.
+static float
+masked_near_depth(const cv::Mat &depth, const cv::Mat &mask)
+{
+    float near = INFINITY;
+    for(int i = 0; i < depth.rows; i++)
+    {
+        const float *d = depth.ptr<float>(i);
+        const uchar *m = mask.ptr<uchar>(i);
+        for(int j = 0; j < depth.cols; j++)
+            if(m[j] && d[j] > 0.0f && d[j] < near)
+                near = d[j];
+    }
+    return(near < INFINITY ? near : 0.0f);
+}
+
+void
+segment_watershed(const cv::Mat &bgr,
+                  const cv::Mat &depth,
+                  const watershed_params &params,
+                  std::vector<obstacle> &obstacles,
+                  cv::Mat &markers,
+                  cv::Mat *view)
+{
+    CV_Assert(bgr.type() == CV_8UC3 && depth.type() == CV_32FC1 && bgr.size() == depth.size());
+    obstacles.clear();
+
+    auto start = NOW;
+    // blur image
+    cv::Mat blur;
+    smooth_image(bgr, blur, params.smooth);
+
+    // setup for contours for regular image
+    cv::Mat edges;
+    cv::Canny(blur, edges, 100, 200);
+
+    auto end = NOW;
+    auto ms = TIME;
+    std::cout << "Preprocessing Time: " << ms << " ms\n";
+
+    start = NOW;
+    // make contours for watershed with 8-bit single-channel image
+    std::vector<cv::Vec4i> hierarchy;
+    std::vector<std::vector<cv::Point> > contours;
+    cv::findContours(edges, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+    markers.create(edges.size(), CV_32S);
+    markers = 0;
+    if(hierarchy.empty())
+    {
+        if(view)
+            *view = cv::Mat::zeros(bgr.size(), CV_8UC3);
+        return;
+    }
+
+    // seed every contour with its own label, 0 is left for unknown pixels
+    int comp_count = 0;
+    for(int idx = 0; idx >= 0; idx = hierarchy[idx][0], comp_count++)
+    {
+        cv::drawContours(markers,
+                         contours,
+                         idx,
+                         cv::Scalar::all(idx + 1),
+                         -1,
+                         8,
+                         hierarchy,
+                         1);
+    }
+
+    end = NOW;
+    ms = TIME;
+    std::cout << "Contours Time: " << ms << " ms\n";
+
+    start = NOW;
+    // watershed the image
+    cv::watershed(blur, markers);
+
+    end = NOW;
+    ms = TIME;
+    std::cout << "Watershed Time: " << ms << " ms\n";
+
+    start = NOW;
+    // one pass over the labels for the size, bounds and depth of every segment
+    std::vector<int> area(comp_count + 1, 0);
+    std::vector<float> far(comp_count + 1, 0.0f);
+    std::vector<float> near(comp_count + 1, INFINITY);
+    std::vector<cv::Point> top_left(comp_count + 1, cv::Point(INT_MAX, INT_MAX));
+    std::vector<cv::Point> bottom_right(comp_count + 1, cv::Point(-1, -1));
+    for(int i = 0; i < markers.rows; i++)
+    {
+        const int *label = markers.ptr<int>(i);
+        const float *d = depth.ptr<float>(i);
+        for(int j = 0; j < markers.cols; j++)
+        {
+            int l = label[j];
+            if(l <= 0 || l > comp_count)
+                continue;
+            area[l]++;
+            if(d[j] > far[l])
+                far[l] = d[j];
+            if(d[j] > 0.0f && d[j] < near[l])
+                near[l] = d[j];
+            top_left[l].x = std::min(top_left[l].x, j);
+            top_left[l].y = std::min(top_left[l].y, i);
+            bottom_right[l].x = std::max(bottom_right[l].x, j);
+            bottom_right[l].y = std::max(bottom_right[l].y, i);
+        }
+    }
+
+    std::vector<bool> is_obstacle(comp_count + 1, false);
+    for(int l = 1; l <= comp_count; l++)
+    {
+        if(area[l] == 0)
+            continue;
+        cv::Rect rect(top_left[l], bottom_right[l] + cv::Point(1, 1));
+        is_obstacle[l] = params.min_area <= area[l] && area[l] <= params.max_area
+            && rect.y + rect.height < markers.rows - 1
+            && far[l] > 0
+            && far[l] <= params.max_range;
+        if(is_obstacle[l])
+            obstacles.push_back({ rect, near[l], area[l], l });
+    }
+    end = NOW;
+    ms = TIME;
+    std::cout << "Obstacles Time: " << ms << " ms\n";
+
+    if(!view)
+        return;
+
+    start = NOW;
+    // put color in segment
+    std::vector<cv::Vec3b> colors(comp_count + 1);
+    for(int l = 1; l <= comp_count; l++)
+        colors[l] = cv::Vec3b(0, rand() % 255, 0);
+
+    view->create(markers.size(), CV_8UC3);
+    for(int i = 0; i < markers.rows; i++)
+    {
+        const int *label = markers.ptr<int>(i);
+        cv::Vec3b *out = view->ptr<cv::Vec3b>(i);
+        for(int j = 0; j < markers.cols; j++)
+        {
+            int l = label[j];
+            if(l == -1)
+                out[j] = cv::Vec3b(255, 255, 255);
+            else if(l <= 0 || l > comp_count || !is_obstacle[l])
+                out[j] = cv::Vec3b(0, 0, 0);
+            else
+                out[j] = colors[l];
+        }
+    }
+    draw_obstacles(*view, obstacles);
+    end = NOW;
+    ms = TIME;
+    std::cout << "Coloring Time: " << ms << " ms\n";
+}
+
+multires_segmenter::multires_segmenter(float target_ms, int max_level)
+    : target_ms(target_ms), max_level(max_level), cur_level(0)
+{
+}
+
+void
+multires_segmenter::segment(const cv::Mat &bgr,
+                            const cv::Mat &depth,
+                            const watershed_params &params,
+                            std::vector<obstacle> &obstacles,
+                            cv::Mat *view)
+{
+    auto start = NOW;
+    int level = cur_level;
+
+    // segment a pyramid level. Depth is decimated, averaging would smear NaN holes
+    cv::Mat small_bgr = bgr;
+    cv::Mat small_depth = depth;
+    for(int l = 0; l < level; l++)
+        cv::pyrDown(small_bgr, small_bgr);
+    if(level > 0)
+        cv::resize(depth, small_depth, small_bgr.size(), 0, 0, cv::INTER_NEAREST);
+
+    int area_scale = 1 << (2 * level);
+    watershed_params coarse_params = params;
+    coarse_params.min_area = params.min_area / area_scale;
+    coarse_params.max_area = params.max_area / area_scale;
+
+    std::vector<obstacle> candidates;
+    cv::Mat markers;
+    segment_watershed(small_bgr, small_depth, coarse_params, candidates, markers);
+
+    obstacles.clear();
+    if(level == 0)
+    {
+        obstacles = candidates;
+    }
+    else
+    {
+        cv::Size2f scale((float) bgr.cols / small_bgr.cols, (float) bgr.rows / small_bgr.rows);
+        for(const obstacle &candidate : candidates)
+        {
+            obstacle refined;
+            if(refine(bgr, depth, markers, candidate, scale, refined))
+                obstacles.push_back(refined);
+        }
+    }
+
+    auto end = NOW;
+    auto ms = TIME;
+    std::cout << "Multires Time: " << ms << " ms at level " << level << "\n";
+
+    // every level down has a quarter of the pixels, so only step back up when
+    // the finer level would still fit in the budget
+    constexpr float level_cost = 4.0f;
+    if(ms > target_ms && cur_level < max_level)
+        cur_level++;
+    else if(ms * level_cost < target_ms * 0.8f && cur_level > 0)
+        cur_level--;
+
+    if(view)
+    {
+        *view = bgr.clone();
+        draw_obstacles(*view, obstacles);
+    }
+}
+
+// Re-runs watershed at full resolution inside the candidate's bounding box only.
+// The upscaled coarse segment is eroded to seed the obstacle and its dilated
+// outside seeds the background, so watershed only has to settle the boundary.
+bool
+multires_segmenter::refine(const cv::Mat &bgr,
+                           const cv::Mat &depth,
+                           const cv::Mat &markers,
+                           const obstacle &candidate,
+                           cv::Size2f scale,
+                           obstacle &refined)
+{
+    // a little context around the candidate so the background seed is not empty
+    constexpr int pad = 2;
+    cv::Rect small_roi(candidate.rect.x - pad,
+                       candidate.rect.y - pad,
+                       candidate.rect.width + 2 * pad,
+                       candidate.rect.height + 2 * pad);
+    small_roi &= cv::Rect(0, 0, markers.cols, markers.rows);
+
+    cv::Rect roi(cvFloor(small_roi.x * scale.width),
+                 cvFloor(small_roi.y * scale.height),
+                 cvCeil(small_roi.width * scale.width),
+                 cvCeil(small_roi.height * scale.height));
+    roi &= cv::Rect(0, 0, bgr.cols, bgr.rows);
+
+    cv::Mat coarse_mask = markers(small_roi) == candidate.id;
+    cv::resize(coarse_mask, coarse_mask, roi.size(), 0, 0, cv::INTER_NEAREST);
+
+    int radius = cvCeil(std::max(scale.width, scale.height));
+    cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * radius + 1, 2 * radius + 1));
+    cv::Mat sure_fg, sure_bg;
+    cv::erode(coarse_mask, sure_fg, kernel);
+    cv::dilate(coarse_mask, sure_bg, kernel);
+
+    refined.id = candidate.id;
+    if(cv::countNonZero(sure_fg) == 0 || cv::countNonZero(sure_bg) == sure_bg.rows * sure_bg.cols)
+    {
+        // too thin to refine, keep the coarse answer
+        refined.rect = roi & cv::Rect(cvFloor(candidate.rect.x * scale.width),
+                                      cvFloor(candidate.rect.y * scale.height),
+                                      cvCeil(candidate.rect.width * scale.width),
+                                      cvCeil(candidate.rect.height * scale.height));
+        refined.area = cvRound(candidate.area * scale.width * scale.height);
+        refined.distance = masked_near_depth(depth(roi), coarse_mask);
+        return(refined.distance > 0);
+    }
+
+    cv::Mat seeds(roi.size(), CV_32S, cv::Scalar(0));
+    seeds.setTo(1, sure_bg == 0);
+    seeds.setTo(2, sure_fg);
+    cv::watershed(bgr(roi), seeds);
+
+    cv::Mat fg = seeds == 2;
+    refined.area = cv::countNonZero(fg);
+    if(refined.area == 0)
+        return(false);
+    refined.rect = cv::boundingRect(fg) + roi.tl();
+    refined.distance = masked_near_depth(depth(roi), fg);
+    return(refined.distance > 0);
+}
@@ -0,0 +1,58 @@
+#ifndef SEGMENT_H_   /* Include guard */
+#define SEGMENT_H_
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include "obstacle.h"
+#include "smooth.h"
+
+// which segments of the watershed count as obstacles
+struct watershed_params
+{
+    int min_area = 5000;    // smaller segments are texture, in pixels at full resolution
+    int max_area = 200000;  // larger segments are the ground or the sky
+    float max_range = 6.0f; // meters
+    smooth_params smooth;   // edge preserving filter run before Canny
+};
+
+// Segments a BGR image with an edge preserving filter, Canny and watershed. Obstacles are
+// segments of a sensible size that do not touch the bottom of the image and whose
+// farthest depth is in range, with their nearest depth as distance. depth is
+// CV_32FC1 in meters with the same size as bgr. markers gets the watershed labels,
+// obstacle ids are labels in it. If view is given it gets the colored segments
+// for debugging.
+void segment_watershed(const cv::Mat &bgr,
+                       const cv::Mat &depth,
+                       const watershed_params &params,
+                       std::vector<obstacle> &obstacles,
+                       cv::Mat &markers,
+                       cv::Mat *view = nullptr);
+
+// Coarse to fine watershed. Segments a level of the image pyramid and refines
+// every candidate at full resolution inside its bounding box only. The level is
+// picked again every frame so segmentation stays under the latency target.
+class multires_segmenter
+{
+public:
+    multires_segmenter(float target_ms, int max_level = 2);
+    void segment(const cv::Mat &bgr,
+                 const cv::Mat &depth,
+                 const watershed_params &params,
+                 std::vector<obstacle> &obstacles,
+                 cv::Mat *view = nullptr);
+    int level() const { return(cur_level); }
+
+private:
+    bool refine(const cv::Mat &bgr,
+                const cv::Mat &depth,
+                const cv::Mat &markers,
+                const obstacle &candidate,
+                cv::Size2f scale,
+                obstacle &refined);
+
+    float target_ms; // time budget for one frame
+    int max_level;   // coarsest pyramid level allowed
+    int cur_level;   // level used for the next frame, 0 is full resolution
+};
+
+#endif // SEGMENT_H_
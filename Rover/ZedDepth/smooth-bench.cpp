@@ -0,0 +1,115 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "timing.h"
+#include "smooth.h"
+#include "segment.h"
+
+// a VGA frame with a few obstacle sized shapes on a gradient, plus sensor noise
+static cv::Mat
+synthetic_image()
+{
+    cv::Mat img(376, 672, CV_8UC3);
+    for(int i = 0; i < img.rows; i++)
+        img.row(i).setTo(cv::Scalar(90 + i / 4, 110 + i / 5, 100));
+    cv::rectangle(img, cv::Rect(80, 120, 130, 90), cv::Scalar(40, 40, 160), -1);
+    cv::circle(img, cv::Point(360, 160), 60, cv::Scalar(170, 60, 40), -1);
+    cv::rectangle(img, cv::Rect(500, 60, 90, 200), cv::Scalar(30, 150, 200), -1);
+
+    cv::Mat noise(img.size(), CV_16SC3);
+    cv::randn(noise, 0, 8);
+    img.convertTo(img, CV_16SC3);
+    img += noise;
+    img.convertTo(img, CV_8UC3);
+    return(img);
+}
+
+// share of the edges in a that lie within a pixel of an edge in b
+static float
+edge_recall(const cv::Mat &a, const cv::Mat &b)
+{
+    int total = cv::countNonZero(a);
+    if(total == 0)
+        return(1.0f);
+    cv::Mat near;
+    cv::dilate(b, near, cv::Mat());
+    return((float) cv::countNonZero(a & near) / total);
+}
+
+// obstacles in found that overlap one in reference by at least half
+static int
+matched_obstacles(const std::vector<obstacle> &found, const std::vector<obstacle> &reference)
+{
+    int matched = 0;
+    for(const obstacle &f : found)
+    {
+        for(const obstacle &r : reference)
+        {
+            float inter = (f.rect & r.rect).area();
+            if(inter / (f.rect.area() + r.rect.area() - inter) >= 0.5f)
+            {
+                matched++;
+                break;
+            }
+        }
+    }
+    return(matched);
+}
+
+int main(int argc, char *argv[])
+{
+    // ./smooth-bench [image.png]
+    cv::Mat bgr = argc > 1 ? cv::imread(argv[1], cv::IMREAD_COLOR) : synthetic_image();
+    if(bgr.empty())
+    {
+        std::cout << "Failed to read " << argv[1] << std::endl;
+        return(1);
+    }
+    // every pixel in range, so only the segmentation decides what is an obstacle
+    cv::Mat depth(bgr.size(), CV_32FC1, cv::Scalar(3.0f));
+
+    constexpr int runs = 20;
+    watershed_params params;
+    cv::Mat reference_edges;
+    std::vector<obstacle> reference;
+    std::cout << std::left << std::setw(12) << "filter" << std::setw(10) << "ms"
+              << std::setw(14) << "edge recall" << std::setw(14) << "edge prec." << "obstacles" << std::endl;
+    for(int f = SMOOTH_BILATERAL; f <= SMOOTH_NONE; f++)
+    {
+        params.smooth.filter = (smooth_filter) f;
+        cv::Mat blur;
+        smooth_image(bgr, blur, params.smooth); // warm up
+        float total = 0.0f;
+        for(int i = 0; i < runs; i++)
+        {
+            auto start = NOW;
+            smooth_image(bgr, blur, params.smooth);
+            auto end = NOW;
+            total += TIME;
+        }
+
+        cv::Mat edges, markers;
+        cv::Canny(blur, edges, 100, 200);
+        std::vector<obstacle> obstacles;
+        // segment_watershed reports its own timing, which would drown the table
+        std::streambuf *out = std::cout.rdbuf(nullptr);
+        segment_watershed(bgr, depth, params, obstacles, markers);
+        std::cout.rdbuf(out);
+        std::cout.clear();
+
+        if(f == SMOOTH_BILATERAL)
+        {
+            reference_edges = edges;
+            reference = obstacles;
+        }
+        std::cout << std::left << std::setw(12) << smooth_filter_name((smooth_filter) f)
+                  << std::setw(10) << std::setprecision(3) << total / runs
+                  << std::setw(14) << edge_recall(reference_edges, edges)
+                  << std::setw(14) << edge_recall(edges, reference_edges)
+                  << matched_obstacles(obstacles, reference) << " of " << reference.size()
+                  << " matched, " << obstacles.size() << " found" << std::endl;
+    }
+    return(0);
+}
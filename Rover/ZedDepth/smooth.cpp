@@ -0,0 +1,312 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "smooth.h"
+
+static const char *filter_names[] = { "bilateral", "guided", "domain", "fixed", "none" };
+
+bool
+parse_smooth_filter(const char *name, smooth_filter &filter)
+{
+    for(int i = 0; i <= SMOOTH_NONE; i++)
+    {
+        if(strcmp(name, filter_names[i]) == 0)
+        {
+            filter = (smooth_filter) i;
+            return(true);
+        }
+    }
+    return(false);
+}
+
+const char *
+smooth_filter_name(smooth_filter filter)
+{
+    return(filter_names[filter]);
+}
+
+// The fast guided filter. The linear coefficients come from box filters at a
+// reduced scale and are upscaled to apply to the full image. The guide is the
+// gray image, which keeps every box filter single or three channel.
+static void
+smooth_guided(const cv::Mat &bgr, cv::Mat &out, const smooth_params &params)
+{
+    int scale = std::max(1, params.guided_scale);
+    cv::Mat full;
+    bgr.convertTo(full, CV_32FC3, 1.0 / 255.0);
+    cv::Mat small = full;
+    if(scale > 1)
+        cv::resize(full, small, cv::Size(bgr.cols / scale, bgr.rows / scale), 0, 0, cv::INTER_AREA);
+
+    int r = std::max(1, params.guided_radius / scale);
+    cv::Size box(2 * r + 1, 2 * r + 1);
+    cv::Mat guide, guide3;
+    cv::cvtColor(small, guide, cv::COLOR_BGR2GRAY);
+    cv::merge(std::vector<cv::Mat>{ guide, guide, guide }, guide3);
+
+    cv::Mat mean_i, mean_p, corr_i, corr_ip;
+    cv::boxFilter(guide, mean_i, CV_32F, box);
+    cv::boxFilter(small, mean_p, CV_32F, box);
+    cv::boxFilter(guide.mul(guide), corr_i, CV_32F, box);
+    cv::boxFilter(guide3.mul(small), corr_ip, CV_32F, box);
+
+    cv::Mat var_i = corr_i - mean_i.mul(mean_i) + params.guided_eps;
+    cv::Mat mean_i3, var_i3;
+    cv::merge(std::vector<cv::Mat>{ mean_i, mean_i, mean_i }, mean_i3);
+    cv::merge(std::vector<cv::Mat>{ var_i, var_i, var_i }, var_i3);
+
+    cv::Mat a, b;
+    cv::divide(corr_ip - mean_i3.mul(mean_p), var_i3, a);
+    b = mean_p - a.mul(mean_i3);
+    cv::boxFilter(a, a, CV_32F, box);
+    cv::boxFilter(b, b, CV_32F, box);
+    if(scale > 1)
+    {
+        cv::resize(a, a, bgr.size(), 0, 0, cv::INTER_LINEAR);
+        cv::resize(b, b, bgr.size(), 0, 0, cv::INTER_LINEAR);
+    }
+
+    cv::Mat full_guide;
+    cv::cvtColor(full, full_guide, cv::COLOR_BGR2GRAY);
+    cv::merge(std::vector<cv::Mat>{ full_guide, full_guide, full_guide }, guide3);
+    cv::Mat q = a.mul(guide3) + b;
+    q.convertTo(out, CV_8UC3, 255.0);
+}
+
+// Recursive filter on the domain transform of Gastal and Oliveira. Distances
+// between neighbours grow with the color difference, so the recursion stops
+// at edges. Each iteration is one pass each way along rows, then along columns.
+static void
+smooth_domain(const cv::Mat &bgr, cv::Mat &out, const smooth_params &params)
+{
+    cv::Mat img;
+    bgr.convertTo(img, CV_32FC3, 1.0 / 255.0);
+    const int rows = img.rows, cols = img.cols;
+    const float ratio = params.domain_sigma_s / params.domain_sigma_r;
+
+    // distance to the left and upper neighbour in the transformed domain
+    cv::Mat dx(rows, cols, CV_32F, cv::Scalar(1.0f)), dy(rows, cols, CV_32F, cv::Scalar(1.0f));
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
+    {
+        for(int y = range.start; y < range.end; y++)
+        {
+            const float *p = img.ptr<float>(y);
+            const float *up = img.ptr<float>(std::max(y - 1, 0));
+            float *hx = dx.ptr<float>(y), *hy = dy.ptr<float>(y);
+            for(int x = 0; x < cols; x++)
+            {
+                if(x > 0)
+                    hx[x] += ratio * (std::abs(p[3 * x] - p[3 * x - 3]) + std::abs(p[3 * x + 1] - p[3 * x - 2]) + std::abs(p[3 * x + 2] - p[3 * x - 1]));
+                if(y > 0)
+                    hy[x] += ratio * (std::abs(p[3 * x] - up[3 * x]) + std::abs(p[3 * x + 1] - up[3 * x + 1]) + std::abs(p[3 * x + 2] - up[3 * x + 2]));
+            }
+        }
+    });
+
+    const int n = std::max(1, params.domain_iterations);
+    cv::Mat vx, vy;
+    for(int i = 0; i < n; i++)
+    {
+        // the sigma halves every iteration so the passes add up to domain_sigma_s
+        float sigma = params.domain_sigma_s * std::sqrt(3.0f) * std::pow(2.0f, n - i - 1) / std::sqrt(std::pow(4.0f, n) - 1.0f);
+        float log_a = -std::sqrt(2.0f) / sigma;
+        cv::exp(dx * log_a, vx);
+        cv::exp(dy * log_a, vy);
+
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
+        {
+            for(int y = range.start; y < range.end; y++)
+            {
+                float *j = img.ptr<float>(y);
+                const float *v = vx.ptr<float>(y);
+                for(int x = 1; x < cols; x++)
+                    for(int c = 0; c < 3; c++)
+                        j[3 * x + c] += v[x] * (j[3 * x - 3 + c] - j[3 * x + c]);
+                for(int x = cols - 2; x >= 0; x--)
+                    for(int c = 0; c < 3; c++)
+                        j[3 * x + c] += v[x + 1] * (j[3 * x + 3 + c] - j[3 * x + c]);
+            }
+        });
+
+        // columns run down the rows, so split them into one band per thread and keep each row streaming
+        cv::parallel_for_(cv::Range(0, cols), [&](const cv::Range &range)
+        {
+            for(int y = 1; y < rows; y++)
+            {
+                float *j = img.ptr<float>(y);
+                const float *prev = img.ptr<float>(y - 1);
+                const float *v = vy.ptr<float>(y);
+                for(int x = range.start; x < range.end; x++)
+                    for(int c = 0; c < 3; c++)
+                        j[3 * x + c] += v[x] * (prev[3 * x + c] - j[3 * x + c]);
+            }
+            for(int y = rows - 2; y >= 0; y--)
+            {
+                float *j = img.ptr<float>(y);
+                const float *next = img.ptr<float>(y + 1);
+                const float *v = vy.ptr<float>(y + 1);
+                for(int x = range.start; x < range.end; x++)
+                    for(int c = 0; c < 3; c++)
+                        j[3 * x + c] += v[x] * (next[3 * x + c] - j[3 * x + c]);
+            }
+        }, cv::getNumThreads());
+    }
+    img.convertTo(out, CV_8UC3, 255.0);
+}
+
+// taps of the fixed point bilateral
+struct fixed_kernel
+{
+    int radius;
+    ushort range;      // weight of a tap is range minus its summed BGR difference
+    ushort spatial[9]; // falls off roughly like a gaussian with sigma 2
+};
+
+// One line of the separable bilateral over three planes. The taps of pixel i are
+// src[c][i + k * step] for k in -radius .. radius, so step 1 runs along a row and
+// the plane step runs down a column. Weights stay under 2^16, so the weight sum
+// fits in 16 bits and only the weighted colors need 32.
+static void
+bilateral_line(const uchar *const src[3], ptrdiff_t step, uchar *const dst[3], int n, const fixed_kernel &kern)
+{
+    const int r = kern.radius;
+    int i = 0;
+#if CV_SIMD
+    constexpr int lanes = cv::v_uint16::nlanes;
+    const cv::v_uint16 v_range = cv::vx_setall_u16(kern.range);
+    for(; i <= n - lanes; i += lanes)
+    {
+        cv::v_uint16 center[3];
+        cv::v_uint32 lo[3], hi[3];
+        for(int c = 0; c < 3; c++)
+        {
+            center[c] = cv::vx_load_expand(src[c] + i);
+            lo[c] = hi[c] = cv::vx_setzero_u32();
+        }
+        cv::v_uint16 weight_sum = cv::vx_setzero_u16();
+        for(int k = -r; k <= r; k++)
+        {
+            cv::v_uint16 tap[3];
+            cv::v_uint16 diff = cv::vx_setzero_u16();
+            for(int c = 0; c < 3; c++)
+            {
+                tap[c] = cv::vx_load_expand(src[c] + i + k * step);
+                diff += cv::v_absdiff(tap[c], center[c]);
+            }
+            // 16 bit subtraction saturates, so taps past the range get weight 0
+            cv::v_uint16 w = cv::v_mul_wrap(v_range - diff, cv::vx_setall_u16(kern.spatial[k + r]));
+            weight_sum += w;
+            for(int c = 0; c < 3; c++)
+            {
+                cv::v_uint32 l, h;
+                cv::v_mul_expand(w, tap[c], l, h);
+                lo[c] += l;
+                hi[c] += h;
+            }
+        }
+
+        cv::v_uint32 sum_lo, sum_hi;
+        cv::v_expand(weight_sum, sum_lo, sum_hi);
+        cv::v_float32 inv_lo = cv::vx_setall_f32(1.0f) / cv::v_cvt_f32(cv::v_reinterpret_as_s32(sum_lo));
+        cv::v_float32 inv_hi = cv::vx_setall_f32(1.0f) / cv::v_cvt_f32(cv::v_reinterpret_as_s32(sum_hi));
+        for(int c = 0; c < 3; c++)
+        {
+            cv::v_int32 q_lo = cv::v_round(cv::v_cvt_f32(cv::v_reinterpret_as_s32(lo[c])) * inv_lo);
+            cv::v_int32 q_hi = cv::v_round(cv::v_cvt_f32(cv::v_reinterpret_as_s32(hi[c])) * inv_hi);
+            cv::v_pack_u_store(dst[c] + i, cv::v_pack(q_lo, q_hi));
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        unsigned weight_sum = 0, sum[3] = { 0, 0, 0 };
+        for(int k = -r; k <= r; k++)
+        {
+            int diff = 0;
+            for(int c = 0; c < 3; c++)
+                diff += std::abs(src[c][i + k * step] - src[c][i]);
+            unsigned w = std::max(kern.range - diff, 0) * kern.spatial[k + r];
+            weight_sum += w;
+            for(int c = 0; c < 3; c++)
+                sum[c] += w * src[c][i + k * step];
+        }
+        for(int c = 0; c < 3; c++)
+            dst[c][i] = (uchar) ((sum[c] + weight_sum / 2) / weight_sum);
+    }
+}
+
+// Bilateral filter split into a pass along rows and a pass down columns, on
+// planar 8 bit images. Not exact, a true bilateral kernel is not separable,
+// but edges survive and each pixel costs 2 * (2 * radius + 1) taps instead of
+// the square of that.
+static void
+smooth_fixed(const cv::Mat &bgr, cv::Mat &out, const smooth_params &params)
+{
+    static const ushort gaussian[5] = { 8, 7, 5, 3, 1 };
+    fixed_kernel kern;
+    kern.radius = std::min(std::max(params.fixed_radius, 1), 4);
+    kern.range = (ushort) std::min(std::max(params.fixed_range, 1), 255);
+    for(int k = -kern.radius; k <= kern.radius; k++)
+        kern.spatial[k + kern.radius] = gaussian[std::abs(k)];
+    const int r = kern.radius;
+
+    std::vector<cv::Mat> planes, padded(3), across(3), result(3);
+    cv::split(bgr, planes);
+    for(int c = 0; c < 3; c++)
+    {
+        cv::copyMakeBorder(planes[c], padded[c], 0, 0, r, r, cv::BORDER_REFLECT_101);
+        across[c].create(bgr.size(), CV_8UC1);
+    }
+    cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range &range)
+    {
+        for(int y = range.start; y < range.end; y++)
+        {
+            const uchar *src[3] = { padded[0].ptr(y) + r, padded[1].ptr(y) + r, padded[2].ptr(y) + r };
+            uchar *dst[3] = { across[0].ptr(y), across[1].ptr(y), across[2].ptr(y) };
+            bilateral_line(src, 1, dst, bgr.cols, kern);
+        }
+    });
+
+    for(int c = 0; c < 3; c++)
+    {
+        cv::copyMakeBorder(across[c], padded[c], r, r, 0, 0, cv::BORDER_REFLECT_101);
+        result[c].create(bgr.size(), CV_8UC1);
+    }
+    cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range &range)
+    {
+        for(int y = range.start; y < range.end; y++)
+        {
+            const uchar *src[3] = { padded[0].ptr(y + r), padded[1].ptr(y + r), padded[2].ptr(y + r) };
+            uchar *dst[3] = { result[0].ptr(y), result[1].ptr(y), result[2].ptr(y) };
+            bilateral_line(src, padded[0].step, dst, bgr.cols, kern);
+        }
+    });
+    cv::merge(result, out);
+}
+
+void
+smooth_image(const cv::Mat &bgr, cv::Mat &out, const smooth_params &params)
+{
+    CV_Assert(bgr.type() == CV_8UC3);
+    switch(params.filter)
+    {
+    case SMOOTH_BILATERAL:
+        cv::bilateralFilter(bgr, out, params.bilateral_diameter, params.bilateral_sigma, params.bilateral_sigma, cv::BORDER_DEFAULT);
+        break;
+    case SMOOTH_GUIDED:
+        smooth_guided(bgr, out, params);
+        break;
+    case SMOOTH_DOMAIN:
+        smooth_domain(bgr, out, params);
+        break;
+    case SMOOTH_FIXED:
+        smooth_fixed(bgr, out, params);
+        break;
+    case SMOOTH_NONE:
+        out = bgr;
+        break;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef SMOOTH_H_   /* Include guard */
+#define SMOOTH_H_
+
+#include <opencv2/core.hpp>
+
+// edge preserving filters that can run before Canny and watershed
+enum smooth_filter
+{
+    SMOOTH_BILATERAL, // cv::bilateralFilter, the reference the others are measured against
+    SMOOTH_GUIDED,    // guided filter with the gray image as guide, coefficients at a reduced scale
+    SMOOTH_DOMAIN,    // recursive domain transform filter, a few 1D passes whatever the radius
+    SMOOTH_FIXED,     // separable bilateral in fixed point with SIMD kernels
+    SMOOTH_NONE       // no smoothing at all, for comparison
+};
+
+struct smooth_params
+{
+    smooth_filter filter = SMOOTH_BILATERAL;
+
+    int bilateral_diameter = 9;
+    double bilateral_sigma = 150.0;  // color and space sigma
+
+    int guided_radius = 4;           // box radius at full resolution
+    float guided_eps = 0.01f;        // regularization, colors are 0 to 1
+    int guided_scale = 2;            // coefficients are computed at 1 / scale
+
+    float domain_sigma_s = 6.0f;     // spatial sigma in pixels
+    float domain_sigma_r = 0.5f;     // range sigma, colors are 0 to 1
+    int domain_iterations = 2;
+
+    int fixed_radius = 4;            // taps on each side of the center
+    int fixed_range = 255;           // summed BGR difference at which a tap stops counting, at most 255
+};
+
+// names as given to --filter, false for an unknown name
+bool parse_smooth_filter(const char *name, smooth_filter &filter);
+const char *smooth_filter_name(smooth_filter filter);
+
+// smooths a CV_8UC3 image into out with the filter in params
+void smooth_image(const cv::Mat &bgr, cv::Mat &out, const smooth_params &params);
+
+#endif // SMOOTH_H_
@@ -0,0 +1,38 @@
+#ifndef SOURCE_H_   /* Include guard */
+#define SOURCE_H_
+
+#include <opencv2/core.hpp>
+#include "capture.h"
+
+// pinhole model of the left camera, in pixels
+struct camera_intrinsics
+{
+    float fx, fy;
+    float cx, cy;
+};
+
+enum grab_result
+{
+    GRAB_OK,    // f holds a new frame
+    GRAB_RETRY, // this frame failed, try the next one
+    GRAB_END    // the recording is over
+};
+
+// Where frames with depth come from. The ZED computes depth on its GPU, the
+// stereo source on the CPU. zed-depth runs the same detection on either.
+class depth_source
+{
+public:
+    virtual ~depth_source() {}
+
+    // starts the camera at fps, point_cloud asks for frame::xyz as well
+    virtual bool open(int fps, bool point_cloud) = 0;
+
+    // fills in everything in f but the frame number
+    virtual grab_result grab(frame &f) = 0;
+
+    virtual cv::Size size() const = 0;
+    virtual camera_intrinsics intrinsics() const = 0;
+};
+
+#endif // SOURCE_H_
@@ -0,0 +1,211 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include <thread>
+#include <opencv2/imgproc.hpp>
+
+#include "stereo.h"
+
+stereo_source::stereo_source(const std::string &device, const std::string &calibration, const stereo_params &params)
+    : device(device), calibration(calibration), params(params)
+{
+}
+
+bool
+stereo_source::open(int fps, bool point_cloud)
+{
+    this->point_cloud = point_cloud;
+    bool index = !device.empty() && std::all_of(device.begin(), device.end(), ::isdigit);
+    bool pipeline = device.find('!') != std::string::npos;
+    recording = !index && !pipeline;
+    if(index)
+    {
+        capture.open(atoi(device.c_str()));
+        capture.set(cv::CAP_PROP_FPS, fps);
+    }
+    else
+    {
+        capture.open(device);
+    }
+    if(!capture.isOpened())
+        return(false);
+
+    // both eyes come in one frame, left then right. The frame read for the size
+    // is the first one grab() hands out, not every backend can seek back to it
+    if(!capture.read(probed) || probed.empty())
+        return(false);
+    image_size = cv::Size(probed.cols / 2, probed.rows);
+    if(!load_calibration())
+        return(false);
+
+    if(params.threads > 0)
+        cv::setNumThreads(params.threads);
+    // 3-way SGBM runs in parallel stripes and needs far less memory than the full 8 paths
+    int cn = 1;
+    matcher = cv::StereoSGBM::create(0,
+                                     params.num_disparities,
+                                     params.block_size,
+                                     8 * cn * params.block_size * params.block_size,
+                                     32 * cn * params.block_size * params.block_size,
+                                     1,
+                                     0,
+                                     10,
+                                     100,
+                                     2,
+                                     cv::StereoSGBM::MODE_SGBM_3WAY);
+
+    frame_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / std::max(fps, 1)));
+    next_frame = std::chrono::steady_clock::now();
+    return(true);
+}
+
+bool
+stereo_source::load_calibration()
+{
+    cv::FileStorage fs(calibration, cv::FileStorage::READ);
+    if(!fs.isOpened())
+    {
+        std::cout << "Failed to read stereo calibration " << calibration << "\n";
+        return(false);
+    }
+
+    if(!fs["baseline"].empty())
+    {
+        // rectified already, nothing to undistort
+        rectify = false;
+        fs["fx"] >> cam.fx;
+        fs["fy"] >> cam.fy;
+        fs["cx"] >> cam.cx;
+        fs["cy"] >> cam.cy;
+        fs["baseline"] >> baseline;
+        return(baseline > 0.0f && cam.fx > 0.0f);
+    }
+
+    cv::Mat K1, D1, K2, D2, R, T;
+    fs["K1"] >> K1;
+    fs["D1"] >> D1;
+    fs["K2"] >> K2;
+    fs["D2"] >> D2;
+    fs["R"] >> R;
+    fs["T"] >> T;
+    if(K1.empty() || K2.empty() || R.empty() || T.empty())
+    {
+        std::cout << "Stereo calibration " << calibration << " has neither baseline nor K1, K2, R and T\n";
+        return(false);
+    }
+
+    cv::Mat R1, R2, P1, P2, Q;
+    cv::stereoRectify(K1, D1, K2, D2, image_size, R, T, R1, R2, P1, P2, Q, cv::CALIB_ZERO_DISPARITY, 0);
+    cv::initUndistortRectifyMap(K1, D1, R1, P1, image_size, CV_16SC2, left_map1, left_map2);
+    cv::initUndistortRectifyMap(K2, D2, R2, P2, image_size, CV_16SC2, right_map1, right_map2);
+    rectify = true;
+    cam.fx = P1.at<double>(0, 0);
+    cam.fy = P1.at<double>(1, 1);
+    cam.cx = P1.at<double>(0, 2);
+    cam.cy = P1.at<double>(1, 2);
+    baseline = -P2.at<double>(0, 3) / P2.at<double>(0, 0);
+    return(baseline > 0.0f);
+}
+
+grab_result
+stereo_source::grab(frame &f)
+{
+    // recordings play back at the requested rate, as if the camera was there
+    if(recording)
+    {
+        std::this_thread::sleep_until(next_frame);
+        next_frame += frame_period;
+        // after a slow frame play on from now instead of rushing to catch up
+        auto now = std::chrono::steady_clock::now();
+        if(now > next_frame)
+            next_frame = now;
+    }
+
+    cv::Mat sbs;
+    if(!probed.empty())
+    {
+        sbs = probed;
+        probed.release();
+    }
+    else if(!capture.read(sbs) || sbs.empty())
+    {
+        if(recording)
+            return(GRAB_END);
+        std::cout << "Failed to grab frame.\n";
+        return(GRAB_RETRY);
+    }
+    f.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    cv::Mat left = sbs(cv::Rect(0, 0, image_size.width, image_size.height));
+    cv::Mat right = sbs(cv::Rect(image_size.width, 0, image_size.width, image_size.height));
+    if(rectify)
+    {
+        cv::Mat right_rectified;
+        cv::remap(left, f.bgr, left_map1, left_map2, cv::INTER_LINEAR);
+        cv::remap(right, right_rectified, right_map1, right_map2, cv::INTER_LINEAR);
+        right = right_rectified;
+    }
+    else
+    {
+        f.bgr = left.clone();
+    }
+
+    compute_depth(f.bgr, right, f.depth);
+    if(point_cloud)
+        compute_xyz(f.depth, f.xyz);
+    return(GRAB_OK);
+}
+
+// Matches the gray images below roi_top. Matching color would triple the cost
+// for little gain on outdoor scenes.
+void
+stereo_source::compute_depth(const cv::Mat &left, const cv::Mat &right, cv::Mat &depth)
+{
+    int top = cvRound(image_size.height * params.roi_top);
+    cv::Mat left_gray, right_gray;
+    cv::cvtColor(left.rowRange(top, image_size.height), left_gray, cv::COLOR_BGR2GRAY);
+    cv::cvtColor(right.rowRange(top, image_size.height), right_gray, cv::COLOR_BGR2GRAY);
+
+    cv::Mat disparity;
+    matcher->compute(left_gray, right_gray, disparity);
+
+    depth.create(image_size, CV_32FC1);
+    depth.rowRange(0, top).setTo(NAN);
+    // disparities are fixed point with 4 fractional bits, invalid ones are negative
+    const float scale = cam.fx * baseline * cv::StereoMatcher::DISP_SCALE;
+    cv::parallel_for_(cv::Range(0, disparity.rows), [&](const cv::Range &range)
+    {
+        for(int i = range.start; i < range.end; i++)
+        {
+            const short *d = disparity.ptr<short>(i);
+            float *z = depth.ptr<float>(i + top);
+            for(int j = 0; j < disparity.cols; j++)
+                z[j] = d[j] > 0 ? scale / d[j] : NAN;
+        }
+    });
+}
+
+// the point cloud the ZED would give, x right, y down and z ahead in meters
+void
+stereo_source::compute_xyz(const cv::Mat &depth, cv::Mat &xyz)
+{
+    xyz.create(depth.size(), CV_32FC4);
+    cv::parallel_for_(cv::Range(0, depth.rows), [&](const cv::Range &range)
+    {
+        for(int v = range.start; v < range.end; v++)
+        {
+            const float *z = depth.ptr<float>(v);
+            float *p = xyz.ptr<float>(v);
+            float y = (v - cam.cy) / cam.fy;
+            for(int u = 0; u < depth.cols; u++)
+            {
+                p[4 * u] = (u - cam.cx) / cam.fx * z[u];
+                p[4 * u + 1] = y * z[u];
+                p[4 * u + 2] = z[u];
+                p[4 * u + 3] = 0.0f;
+            }
+        }
+    });
+}
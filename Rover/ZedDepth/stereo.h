@@ -0,0 +1,63 @@
+#ifndef STEREO_H_   /* Include guard */
+#define STEREO_H_
+
+#include <chrono>
+#include <string>
+#include <opencv2/core.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/videoio.hpp>
+#include "source.h"
+
+// tuning for the CPU depth, the defaults keep VGA at about camera rate on the rover
+struct stereo_params
+{
+    int num_disparities = 48; // multiple of 16, depth closer than fx * baseline / num_disparities is lost
+    int block_size = 5;
+    float roi_top = 0.3f;     // share of rows at the top that are never matched, mostly sky
+    int threads = 0;          // threads for the matcher, 0 leaves OpenCV's default
+};
+
+// Depth on the CPU with semi-global block matching, from a side by side stereo
+// device or a recording of one. A ZED shows up as such a device without its SDK.
+// Only the rows below roi_top are matched, over a reduced disparity range, and
+// the rest of the depth map is NaN like the ZED's holes.
+//
+// The calibration is an OpenCV FileStorage file. It either has fx, fy, cx, cy and
+// baseline (meters) for frames that are rectified already, or K1, D1, K2, D2, R
+// and T (meters) from cv::stereoCalibrate to rectify with.
+class stereo_source : public depth_source
+{
+public:
+    // device is a camera index, a GStreamer pipeline or a video file. Files play
+    // back at the fps given to open(), the others run at their own rate.
+    stereo_source(const std::string &device, const std::string &calibration, const stereo_params &params = stereo_params());
+    bool open(int fps, bool point_cloud) override;
+    grab_result grab(frame &f) override;
+    cv::Size size() const override { return(image_size); }
+    camera_intrinsics intrinsics() const override { return(cam); }
+
+private:
+    bool load_calibration();
+    void compute_depth(const cv::Mat &left, const cv::Mat &right, cv::Mat &depth);
+    void compute_xyz(const cv::Mat &depth, cv::Mat &xyz);
+
+    std::string device;
+    std::string calibration;
+    stereo_params params;
+    bool point_cloud = false;
+
+    cv::VideoCapture capture;
+    bool recording = false;
+    cv::Mat probed; // frame read by open(), handed out by the first grab()
+    std::chrono::steady_clock::duration frame_period;
+    std::chrono::steady_clock::time_point next_frame;
+
+    cv::Size image_size; // one eye
+    camera_intrinsics cam;
+    float baseline = 0.0f;
+    bool rectify = false;
+    cv::Mat left_map1, left_map2, right_map1, right_map2;
+    cv::Ptr<cv::StereoSGBM> matcher;
+};
+
+#endif // STEREO_H_
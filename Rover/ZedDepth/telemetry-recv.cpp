@@ -0,0 +1,81 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include "telemetry.h"
+
+int main(int argc, char *argv[])
+{
+    // ./telemetry-recv [port], run zed-depth with --telemetry=<this host>:<port>
+    int port = argc > 1 ? atoi(argv[1]) : TELEMETRY_PORT;
+    telemetry_receiver receiver;
+    if(!receiver.open(port))
+    {
+        std::cout << "Failed to listen on port " << port << std::endl;
+        return(1);
+    }
+    std::cout << "Listening on port " << port << std::endl;
+
+    telemetry_header header;
+    std::vector<telemetry_obstacle> obstacles;
+    bool first = true;
+    uint32_t next_frame = 0;
+    // more frames missing than this in a row is not loss, about a minute at 15 fps
+    const int32_t max_gap = 1000;
+    long bytes = 0, frames = 0, lost = 0;
+    auto last_report = std::chrono::steady_clock::now();
+    while(true)
+    {
+        int len = receiver.receive(header, obstacles, 1000);
+        if(len < 0)
+        {
+            std::cout << "Failed to receive" << std::endl;
+            return(1);
+        }
+        if(len > 0)
+        {
+            // small gaps ahead are lost datagrams, a little behind is one that came
+            // late and was counted lost, anything further is a restarted sender
+            int32_t gap = (int32_t)(header.frame - next_frame);
+            if(first || gap == 0 || (gap > 0 && gap <= max_gap))
+            {
+                if(!first)
+                    lost += gap;
+                next_frame = header.frame + 1;
+            }
+            else if(gap < 0 && gap >= -max_gap)
+            {
+                if(lost > 0)
+                    lost--;
+            }
+            else
+            {
+                std::cout << "Resync at frame " << header.frame << std::endl;
+                next_frame = header.frame + 1;
+            }
+            first = false;
+            bytes += len;
+            frames++;
+
+            std::cout << "Frame " << header.frame << " mode " << (int) header.mode << ", "
+                      << header.count << " obstacles in " << header.width << "x" << header.height << std::endl;
+            for(const telemetry_obstacle &o : obstacles)
+            {
+                std::cout << "  " << o.id << ": " << o.width << "x" << o.height << " at " << o.x << "," << o.y
+                          << ", " << o.distance_mm / 1000.0f << " m, confidence " << (int) o.confidence << std::endl;
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        float seconds = std::chrono::duration<float>(now - last_report).count();
+        if(seconds >= 5.0f)
+        {
+            std::cout << frames / seconds << " frames/s, " << bytes * 8 / seconds / 1000.0f << " kbit/s, "
+                      << lost << " lost" << std::endl;
+            bytes = frames = lost = 0;
+            last_report = now;
+        }
+    }
+    return(0);
+}
@@ -0,0 +1,142 @@
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "telemetry.h"
+
+telemetry_sender::~telemetry_sender()
+{
+    if(sock >= 0)
+        close(sock);
+}
+
+bool
+telemetry_sender::open(const char *address)
+{
+    std::string host = address;
+    std::string port = std::to_string(TELEMETRY_PORT);
+    size_t colon = host.rfind(':');
+    if(colon != std::string::npos)
+    {
+        port = host.substr(colon + 1);
+        host = host.substr(0, colon);
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *result;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+        return(false);
+
+    // connected, so every send goes to the same place without a lookup
+    for(addrinfo *ai = result; ai; ai = ai->ai_next)
+    {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(sock < 0)
+            continue;
+        if(connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(result);
+    buffer.resize(sizeof(telemetry_header) + TELEMETRY_MAX * sizeof(telemetry_obstacle));
+    return(sock >= 0);
+}
+
+void
+telemetry_sender::send(uint64_t timestamp_ns,
+                       uint8_t mode,
+                       uint16_t width,
+                       uint16_t height,
+                       const std::vector<telemetry_obstacle> &obstacles)
+{
+    if(sock < 0)
+        return;
+
+    telemetry_header header;
+    header.magic = TELEMETRY_MAGIC;
+    header.version = TELEMETRY_VERSION;
+    header.mode = mode;
+    header.count = std::min<size_t>(obstacles.size(), TELEMETRY_MAX);
+    header.frame = frame++;
+    header.timestamp_ns = timestamp_ns;
+    header.width = width;
+    header.height = height;
+
+    memcpy(buffer.data(), &header, sizeof(header));
+    if(header.count)
+        memcpy(buffer.data() + sizeof(header), obstacles.data(), header.count * sizeof(telemetry_obstacle));
+    // ECONNREFUSED just means nobody is listening right now
+    ::send(sock, buffer.data(), sizeof(header) + header.count * sizeof(telemetry_obstacle), MSG_DONTWAIT);
+}
+
+telemetry_receiver::~telemetry_receiver()
+{
+    if(sock >= 0)
+        close(sock);
+}
+
+bool
+telemetry_receiver::open(int port)
+{
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0)
+        return(false);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        close(sock);
+        sock = -1;
+        return(false);
+    }
+    buffer.resize(65536); // anything a datagram can hold
+    return(true);
+}
+
+int
+telemetry_receiver::receive(telemetry_header &header, std::vector<telemetry_obstacle> &obstacles, int timeout_ms)
+{
+    pollfd pfd = { sock, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeout_ms);
+    if(ready <= 0)
+        return(ready);
+
+    ssize_t len = recv(sock, buffer.data(), buffer.size(), 0);
+    if(len < 0)
+        return(-1);
+    if(!parse_telemetry(buffer.data(), len, header, obstacles))
+        return(0);
+    return(len);
+}
+
+bool
+parse_telemetry(const uint8_t *data, size_t len, telemetry_header &header, std::vector<telemetry_obstacle> &obstacles)
+{
+    if(len < sizeof(header))
+        return(false);
+    memcpy(&header, data, sizeof(header));
+    if(header.magic != TELEMETRY_MAGIC
+       || header.version != TELEMETRY_VERSION
+       || header.count > TELEMETRY_MAX
+       || len != sizeof(header) + header.count * sizeof(telemetry_obstacle))
+        return(false);
+
+    obstacles.resize(header.count);
+    if(header.count)
+        memcpy(obstacles.data(), data + sizeof(header), header.count * sizeof(telemetry_obstacle));
+    return(true);
+}
@@ -0,0 +1,80 @@
+#ifndef TELEMETRY_H_   /* Include guard */
+#define TELEMETRY_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Obstacles of one frame in one small UDP datagram, for watching zed-depth from the
+// base station without streaming the debug video. Fields are little-endian, like
+// both the rover and the base station.
+#define TELEMETRY_PORT 5557
+#define TELEMETRY_MAGIC 0x4c45545a // "ZTEL"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX 64 // obstacles per datagram, keeps it under 1 KB
+
+#pragma pack(push, 1)
+struct telemetry_header
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t mode;          // detection mode of zed-depth
+    uint16_t count;        // telemetry_obstacle records that follow
+    uint32_t frame;        // counts up by one per datagram, gaps are lost datagrams
+    uint64_t timestamp_ns; // capture time of the camera frame
+    uint16_t width;        // size of the image the boxes are in
+    uint16_t height;
+};
+
+struct telemetry_obstacle
+{
+    uint16_t x, y, width, height; // bounding box in pixels
+    uint16_t distance_mm;
+    uint16_t id;
+    uint8_t confidence;           // share of the box the obstacle fills, 255 is all of it
+    uint8_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(telemetry_header) == 24, "the header is part of the wire format");
+static_assert(sizeof(telemetry_obstacle) == 14, "records are part of the wire format");
+
+// Sends a datagram per frame to one address. Sending never blocks and errors are
+// dropped, a missing receiver must not slow down detection.
+class telemetry_sender
+{
+public:
+    ~telemetry_sender();
+    bool open(const char *address); // host:port, or just host for TELEMETRY_PORT
+    void send(uint64_t timestamp_ns,
+              uint8_t mode,
+              uint16_t width,
+              uint16_t height,
+              const std::vector<telemetry_obstacle> &obstacles);
+
+private:
+    int sock = -1;
+    uint32_t frame = 0;
+    std::vector<uint8_t> buffer;
+};
+
+// Receives and checks datagrams from a telemetry_sender
+class telemetry_receiver
+{
+public:
+    ~telemetry_receiver();
+    bool open(int port = TELEMETRY_PORT);
+
+    // waits up to timeout_ms for a datagram. Returns its size, 0 on timeout or a
+    // datagram that is not telemetry, and -1 on a socket error.
+    int receive(telemetry_header &header, std::vector<telemetry_obstacle> &obstacles, int timeout_ms);
+
+private:
+    int sock = -1;
+    std::vector<uint8_t> buffer;
+};
+
+// checks and unpacks one datagram, false if it is not telemetry this version understands
+bool parse_telemetry(const uint8_t *data, size_t len, telemetry_header &header, std::vector<telemetry_obstacle> &obstacles);
+
+#endif // TELEMETRY_H_
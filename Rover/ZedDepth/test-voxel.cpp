@@ -0,0 +1,139 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include "timing.h"
+#include "voxel.h"
+
+// an axis aligned box in camera coordinates
+struct box
+{
+    float min[3];
+    float max[3];
+};
+
+// distance along the ray to where it enters b, INFINITY if it misses
+static float
+hit_box(const float dir[3], const box &b)
+{
+    float near = 0.0f, far = INFINITY;
+    for(int k = 0; k < 3; k++)
+    {
+        float t1 = b.min[k] / dir[k], t2 = b.max[k] / dir[k];
+        near = std::max(near, std::min(t1, t2));
+        far = std::min(far, std::max(t1, t2));
+    }
+    return(near <= far ? near : INFINITY);
+}
+
+// what synthetic_cloud puts in front of the camera, nearest first
+static const float camera_height = 0.5f;
+static const box boxes[2] = {
+    { { -0.5f, 0.0f, 2.0f }, { 0.3f, 0.5f, 2.4f } }, // knee high, 2 m ahead
+    { { 1.0f, -0.5f, 4.0f }, { 1.4f, 0.5f, 4.3f } }, // a post off to the right
+};
+
+// Renders what a VGA ZED half a meter above flat ground would see, with two boxes
+// in front of it, a centimeter of noise and some holes.
+static void
+synthetic_cloud(std::vector<float> &xyz, int &width, int &height)
+{
+    width = 672;
+    height = 376;
+    const float fx = 350.0f, cx = 336.0f, cy = 188.0f;
+
+    std::minstd_rand gen(7);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::uniform_real_distribution<float> hole(0.0f, 1.0f);
+    xyz.assign((size_t) width * height * 4, NAN);
+    for(int v = 0; v < height; v++)
+    {
+        for(int u = 0; u < width; u++)
+        {
+            float dir[3] = { (u - cx) / fx, (v - cy) / fx, 1.0f };
+            float t = dir[1] > 0.0f ? camera_height / dir[1] : INFINITY;
+            for(const box &b : boxes)
+                t = std::min(t, hit_box(dir, b));
+            if(t == INFINITY || hole(gen) < 0.05f)
+                continue;
+            t += noise(gen);
+            float *p = &xyz[((size_t) v * width + u) * 4];
+            p[0] = dir[0] * t;
+            p[1] = dir[1] * t;
+            p[2] = dir[2] * t;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // ./test-voxel [cloud.bin from save-depth]
+    std::vector<float> xyz;
+    int width, height;
+    if(argc > 1)
+    {
+        if(!load_cloud(argv[1], xyz, width, height))
+        {
+            std::cout << "Failed to load " << argv[1] << std::endl;
+            return(1);
+        }
+    }
+    else
+    {
+        synthetic_cloud(xyz, width, height);
+    }
+
+    voxel_detector detector;
+    std::vector<obstacle3d> obstacles;
+    constexpr int runs = 20;
+    float total = 0.0f;
+    for(int i = 0; i < runs; i++)
+    {
+        auto start = NOW;
+        if(!detector.detect(xyz.data(), width, height, width * 4, obstacles))
+        {
+            std::cout << "No ground plane found" << std::endl;
+            return(1);
+        }
+        auto end = NOW;
+        total += TIME;
+    }
+
+    const ground_plane &g = detector.ground();
+    std::cout << "Ground: " << g.a << " x + " << g.b << " y + " << g.c << " z + " << g.d << " = 0" << std::endl;
+    std::cout << detector.voxels().size() << " voxels, " << total / runs << " ms per frame" << std::endl;
+    for(const obstacle3d &o : obstacles)
+    {
+        std::cout << "Obstacle " << o.id << ": x " << o.min[0] << " to " << o.max[0]
+                  << ", z " << o.min[2] << " to " << o.max[2]
+                  << ", " << o.height << " m high, " << o.voxels << " voxels" << std::endl;
+    }
+    if(argc > 1)
+        return(0);
+
+    // the synthetic scene is known, so check what was found against it. A voxel
+    // plus the noise is as close as the extents can get.
+    const float tolerance = 0.15f;
+    bool ok = true;
+    auto check = [&ok](bool passed, const std::string &what) {
+        if(!passed)
+            std::cout << "FAILED: " << what << std::endl;
+        ok = ok && passed;
+    };
+    check(-g.b > 0.999f, "ground normal is up");
+    check(std::abs(g.d - camera_height) < 0.05f, "ground is half a meter below the camera");
+    check(obstacles.size() == 2, "two obstacles found");
+    for(size_t i = 0; i < obstacles.size() && i < 2; i++)
+    {
+        const obstacle3d &o = obstacles[i];
+        const box &b = boxes[i];
+        std::string name = "obstacle " + std::to_string(i);
+        check(std::abs(o.min[0] - b.min[0]) < tolerance && std::abs(o.max[0] - b.max[0]) < tolerance, name + " x extent");
+        check(std::abs(o.min[2] - b.min[2]) < tolerance, name + " front face");
+        check(std::abs(o.height - (camera_height - b.min[1])) < tolerance, name + " height");
+    }
+    std::cout << (ok ? "Passed" : "Failed") << std::endl;
+    return(ok ? 0 : 1);
+}
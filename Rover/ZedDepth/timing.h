@@ -0,0 +1,10 @@
+#ifndef TIMING_H_   /* Include guard */
+#define TIMING_H_
+
+#include <chrono>
+
+// auto start = NOW; ... auto end = NOW; float ms = TIME;
+#define TIME std::chrono::duration<float, std::milli>(end - start).count()
+#define NOW std::chrono::high_resolution_clock::now();
+
+#endif // TIMING_H_
@@ -0,0 +1,166 @@
+#include <cmath>
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "tracker.h"
+
+static float
+median(std::vector<float> &values)
+{
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return(values[values.size() / 2]);
+}
+
+// median and nearest valid depth under mask, false if the mask has no valid depth
+static bool
+segment_depth(const cv::Mat &depth, const cv::Mat &mask, float &median_depth, float &near)
+{
+    std::vector<float> values;
+    for(int i = 0; i < depth.rows; i++)
+    {
+        const float *d = depth.ptr<float>(i);
+        const uchar *m = mask.ptr<uchar>(i);
+        for(int j = 0; j < depth.cols; j++)
+            if(m[j] && d[j] > 0.0f && d[j] < INFINITY) // also false for NaN
+                values.push_back(d[j]);
+    }
+    if(values.empty())
+        return(false);
+
+    near = *std::min_element(values.begin(), values.end());
+    median_depth = median(values);
+    return(true);
+}
+
+obstacle_tracker::obstacle_tracker(const tracker_params &params)
+    : params(params), frames_since_key(0), next_id(1)
+{
+}
+
+bool
+obstacle_tracker::update(const cv::Mat &gray, const cv::Mat &depth)
+{
+    if(prev_gray.empty() || ++frames_since_key >= params.keyframe_interval)
+        return(false);
+
+    // features inside every segment of the previous frame, all tracked in one call
+    std::vector<cv::Point2f> points;
+    std::vector<int> owner;
+    for(int t = 0; t < (int) tracks.size(); t++)
+    {
+        std::vector<cv::Point2f> corners;
+        cv::goodFeaturesToTrack(prev_gray(tracks[t].rect), corners, params.max_corners, 0.01, 3, tracks[t].mask);
+        for(const cv::Point2f &c : corners)
+        {
+            points.push_back(c + cv::Point2f(tracks[t].rect.tl()));
+            owner.push_back(t);
+        }
+    }
+
+    std::vector<cv::Point2f> next;
+    std::vector<uchar> status;
+    std::vector<float> err;
+    if(!points.empty())
+        cv::calcOpticalFlowPyrLK(prev_gray, gray, points, next, status, err, cv::Size(15, 15), 2);
+
+    std::vector<std::vector<float> > dx(tracks.size()), dy(tracks.size());
+    for(size_t i = 0; i < points.size(); i++)
+    {
+        if(!status[i])
+            continue;
+        dx[owner[i]].push_back(next[i].x - points[i].x);
+        dy[owner[i]].push_back(next[i].y - points[i].y);
+    }
+
+    cv::Rect frame(0, 0, gray.cols, gray.rows);
+    std::vector<track> moved;
+    for(int t = 0; t < (int) tracks.size(); t++)
+    {
+        if((int) dx[t].size() < params.min_points)
+            return(false);
+
+        // move the segment by the median flow and crop it to what is still in view
+        track tr = tracks[t];
+        cv::Rect rect = tr.rect + cv::Point(cvRound(median(dx[t])), cvRound(median(dy[t])));
+        cv::Rect visible = rect & frame;
+        if(visible.area() == 0)
+            continue; // drove past it
+        tr.mask = tr.mask(visible - rect.tl()).clone();
+        tr.rect = visible;
+
+        // the segment should be about as far away as it was last frame
+        float median_depth;
+        if(!segment_depth(depth(tr.rect), tr.mask, median_depth, tr.distance)
+           || std::abs(median_depth - tr.median) > params.max_depth_change)
+            return(false);
+        tr.median = median_depth;
+        tr.area = cv::countNonZero(tr.mask);
+        moved.push_back(tr);
+    }
+
+    tracks.swap(moved);
+    gray.copyTo(prev_gray);
+    return(true);
+}
+
+void
+obstacle_tracker::reset(const cv::Mat &gray,
+                        const cv::Mat &depth,
+                        const std::vector<obstacle> &obstacles,
+                        const cv::Mat &markers)
+{
+    std::vector<track> fresh;
+    std::vector<bool> taken(tracks.size(), false);
+    for(const obstacle &o : obstacles)
+    {
+        track tr;
+        tr.rect = o.rect;
+        if(markers.empty())
+            tr.mask = cv::Mat(o.rect.size(), CV_8U, cv::Scalar(255));
+        else
+            tr.mask = markers(o.rect) == o.id;
+        if(!segment_depth(depth(o.rect), tr.mask, tr.median, tr.distance))
+            continue;
+        tr.distance = o.distance;
+        tr.area = o.area;
+
+        // keep the id of the old track this overlaps the most
+        int best = -1;
+        float best_iou = params.min_iou;
+        for(int t = 0; t < (int) tracks.size(); t++)
+        {
+            if(taken[t])
+                continue;
+            float inter = (o.rect & tracks[t].rect).area();
+            float iou = inter / (o.rect.area() + tracks[t].rect.area() - inter);
+            if(iou >= best_iou)
+            {
+                best_iou = iou;
+                best = t;
+            }
+        }
+        if(best >= 0)
+        {
+            taken[best] = true;
+            tr.id = tracks[best].id;
+        }
+        else
+        {
+            tr.id = next_id++;
+        }
+        fresh.push_back(tr);
+    }
+
+    tracks.swap(fresh);
+    gray.copyTo(prev_gray);
+    frames_since_key = 0;
+}
+
+void
+obstacle_tracker::get_obstacles(std::vector<obstacle> &obstacles) const
+{
+    obstacles.clear();
+    for(const track &tr : tracks)
+        obstacles.push_back({ tr.rect, tr.distance, tr.area, tr.id });
+}
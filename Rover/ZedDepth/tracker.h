@@ -0,0 +1,58 @@
+#ifndef TRACKER_H_   /* Include guard */
+#define TRACKER_H_
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include "obstacle.h"
+
+struct tracker_params
+{
+    int keyframe_interval = 15;    // full segmentation at least every this many frames
+    int max_corners = 20;          // flow features tracked per obstacle
+    int min_points = 6;            // fewer surviving features than this is a tracking failure
+    float max_depth_change = 0.3f; // meters the median depth may move in one frame
+    float min_iou = 0.3f;          // overlap needed to give a new segment an old id
+};
+
+// Carries obstacles from one segmentation to the next frames. Each obstacle keeps
+// its watershed segment as a mask, which is moved by the median optical flow of
+// features inside it and checked against the new depth. When a check fails or the
+// keyframe interval runs out the caller segments again and hands the result to
+// reset(), which keeps the ids of obstacles that overlap old ones.
+class obstacle_tracker
+{
+public:
+    obstacle_tracker(const tracker_params &params = tracker_params());
+
+    // moves the tracks onto this frame, returns false if a full segmentation is needed
+    bool update(const cv::Mat &gray, const cv::Mat &depth);
+
+    // starts over from a full segmentation. Segment masks are taken from markers
+    // by obstacle id, without markers the whole bounding box is used.
+    void reset(const cv::Mat &gray,
+               const cv::Mat &depth,
+               const std::vector<obstacle> &obstacles,
+               const cv::Mat &markers);
+
+    // the tracked obstacles, with their track ids as id
+    void get_obstacles(std::vector<obstacle> &obstacles) const;
+
+private:
+    struct track
+    {
+        int id;
+        cv::Rect rect;   // bounds of the segment in the last frame
+        cv::Mat mask;    // the segment inside rect
+        float median;    // median depth of the segment, for the consistency check
+        float distance;  // nearest depth, as the detectors report it
+        int area;
+    };
+
+    tracker_params params;
+    std::vector<track> tracks;
+    cv::Mat prev_gray;
+    int frames_since_key;
+    int next_id;
+};
+
+#endif // TRACKER_H_
@@ -0,0 +1,435 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "voxel.h"
+
+// Cell coordinates are packed 21 bits each into the key, offset so they are never negative
+static const int key_bits = 21;
+static const int64_t key_offset = 1 << (key_bits - 1);
+static const uint64_t key_mask = (1ull << key_bits) - 1;
+static const uint64_t empty_key = ~0ull; // keys use 63 bits, so this never collides
+
+static inline uint64_t
+pack_key(int64_t ix, int64_t iy, int64_t iz)
+{
+    return(((uint64_t) (ix + key_offset) & key_mask) << (2 * key_bits)
+           | ((uint64_t) (iy + key_offset) & key_mask) << key_bits
+           | ((uint64_t) (iz + key_offset) & key_mask));
+}
+
+static inline void
+unpack_key(uint64_t key, int64_t &ix, int64_t &iy, int64_t &iz)
+{
+    ix = (int64_t) ((key >> (2 * key_bits)) & key_mask) - key_offset;
+    iy = (int64_t) ((key >> key_bits) & key_mask) - key_offset;
+    iz = (int64_t) (key & key_mask) - key_offset;
+}
+
+// Open addressing hash from voxel key to an index, with linear probing. Nothing is
+// ever removed, it is reset every frame, which keeps the probe loops trivial.
+class voxel_index
+{
+public:
+    void
+    reset(size_t expected)
+    {
+        size_t size = 64;
+        while(size < 2 * expected)
+            size <<= 1;
+        keys.assign(size, empty_key);
+        values.resize(size);
+        mask = size - 1;
+    }
+
+    // index stored for key, -1 if there is none
+    int
+    find(uint64_t key) const
+    {
+        for(size_t i = slot(key); ; i = (i + 1) & mask)
+        {
+            if(keys[i] == key)
+                return(values[i]);
+            if(keys[i] == empty_key)
+                return(-1);
+        }
+    }
+
+    // index stored for key, storing value first if key is new
+    int
+    insert(uint64_t key, int value)
+    {
+        for(size_t i = slot(key); ; i = (i + 1) & mask)
+        {
+            if(keys[i] == key)
+                return(values[i]);
+            if(keys[i] == empty_key)
+            {
+                keys[i] = key;
+                values[i] = value;
+                return(value);
+            }
+        }
+    }
+
+private:
+    size_t
+    slot(uint64_t key) const
+    {
+        // neighbouring cells differ in few bits, so mix them all in
+        uint64_t h = key * 0x9E3779B97F4A7C15ull;
+        return((size_t) (h ^ (h >> 32)) & mask);
+    }
+
+    std::vector<uint64_t> keys;
+    std::vector<int> values;
+    size_t mask = 0;
+};
+
+// runs work(0) .. work(n - 1) at the same time, work(0) on the calling thread
+static void
+run_threads(int n, const std::function<void(int)> &work)
+{
+    std::vector<std::thread> pool;
+    for(int t = 1; t < n; t++)
+        pool.emplace_back(work, t);
+    work(0);
+    for(std::thread &th : pool)
+        th.join();
+}
+
+voxel_detector::voxel_detector(const voxel_params &params)
+    : params(params), plane{ 0.0f, 0.0f, 0.0f, 0.0f }, has_plane(false), rng(1)
+{
+}
+
+bool
+voxel_detector::detect(const float *xyz, int width, int height, size_t row_floats, std::vector<obstacle3d> &obstacles)
+{
+    obstacles.clear();
+    build_grid(xyz, width, height, row_floats);
+    if(!fit_ground())
+        return(false);
+    cluster(obstacles);
+    return(true);
+}
+
+// Every thread bins a band of rows into its own table, then the bands are merged.
+// Voxels hold running sums until the merge turns them into centroids.
+void
+voxel_detector::build_grid(const float *xyz, int width, int height, size_t row_floats)
+{
+    const int threads = std::max(1, params.threads);
+    const int stride = std::max(1, params.point_stride);
+    const float inv_size = 1.0f / params.voxel_size;
+    const int rows = (height + stride - 1) / stride;
+    std::vector<std::vector<voxel> > bands(threads);
+
+    run_threads(threads, [&](int t)
+    {
+        int first = rows * t / threads;
+        int last = rows * (t + 1) / threads;
+        std::vector<voxel> &cells = bands[t];
+        voxel_index index;
+        // sized for every point in its own voxel, so the table never fills up
+        index.reset((size_t) (last - first) * ((width + stride - 1) / stride));
+        for(int r = first; r < last; r++)
+        {
+            const float *row = xyz + (size_t) r * stride * row_floats;
+            for(int c = 0; c < width; c += stride)
+            {
+                const float *p = row + 4 * c;
+                // comparisons with NaN are false, so holes drop out here
+                if(!(p[2] > 0.0f && p[2] <= params.max_range) || !std::isfinite(p[0]) || !std::isfinite(p[1]))
+                    continue;
+                uint64_t key = pack_key((int64_t) std::floor(p[0] * inv_size),
+                                        (int64_t) std::floor(p[1] * inv_size),
+                                        (int64_t) std::floor(p[2] * inv_size));
+                int i = index.insert(key, cells.size());
+                if(i == (int) cells.size())
+                    cells.push_back({ key, 0.0f, 0.0f, 0.0f, 0 });
+                voxel &v = cells[i];
+                v.x += p[0];
+                v.y += p[1];
+                v.z += p[2];
+                v.count++;
+            }
+        }
+    });
+
+    size_t total = 0;
+    for(const std::vector<voxel> &cells : bands)
+        total += cells.size();
+
+    std::vector<voxel> merged;
+    merged.reserve(total);
+    voxel_index index;
+    index.reset(total);
+    for(const std::vector<voxel> &cells : bands)
+    {
+        for(const voxel &c : cells)
+        {
+            int i = index.insert(c.key, merged.size());
+            if(i == (int) merged.size())
+            {
+                merged.push_back(c);
+                continue;
+            }
+            merged[i].x += c.x;
+            merged[i].y += c.y;
+            merged[i].z += c.z;
+            merged[i].count += c.count;
+        }
+    }
+
+    grid.clear();
+    for(voxel &v : merged)
+    {
+        if(v.count < params.min_voxel_points)
+            continue;
+        v.x /= v.count;
+        v.y /= v.count;
+        v.z /= v.count;
+        grid.push_back(v);
+    }
+}
+
+// RANSAC over voxel centroids. Last frame's plane is scored first, so the ground
+// stays put while the random planes only have to beat it. Planes leaning more than
+// max_tilt away from up are walls, not ground, and are never considered.
+bool
+voxel_detector::fit_ground()
+{
+    const size_t n = grid.size();
+    if(n < 3)
+        return(false);
+
+    // the centroids once more as plain arrays, the scoring loop streams through them
+    std::vector<float> xs(n), ys(n), zs(n);
+    for(size_t i = 0; i < n; i++)
+    {
+        xs[i] = grid[i].x;
+        ys[i] = grid[i].y;
+        zs[i] = grid[i].z;
+    }
+    const float tolerance = params.ground_tolerance;
+    auto score = [&](const ground_plane &p)
+    {
+        int inliers = 0;
+        for(size_t i = 0; i < n; i++)
+            inliers += std::abs(p.a * xs[i] + p.b * ys[i] + p.c * zs[i] + p.d) < tolerance;
+        return(inliers);
+    };
+
+    float up_len = std::sqrt(params.up[0] * params.up[0] + params.up[1] * params.up[1] + params.up[2] * params.up[2]);
+    float up[3] = { params.up[0] / up_len, params.up[1] / up_len, params.up[2] / up_len };
+    float min_cos = std::cos(params.max_tilt * 3.14159265f / 180.0f);
+
+    const int threads = std::max(1, params.threads);
+    std::vector<ground_plane> best(threads, plane);
+    std::vector<int> best_score(threads, has_plane ? score(plane) : 0);
+    std::vector<unsigned> seeds(threads);
+    for(unsigned &s : seeds)
+        s = rng();
+
+    run_threads(threads, [&](int t)
+    {
+        std::minstd_rand gen(seeds[t]);
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+        int iterations = params.ransac_iterations * (t + 1) / threads - params.ransac_iterations * t / threads;
+        for(int it = 0; it < iterations; it++)
+        {
+            size_t i = pick(gen), j = pick(gen), k = pick(gen);
+            if(i == j || j == k || i == k)
+                continue;
+            float u[3] = { xs[j] - xs[i], ys[j] - ys[i], zs[j] - zs[i] };
+            float v[3] = { xs[k] - xs[i], ys[k] - ys[i], zs[k] - zs[i] };
+            float normal[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+            float len = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            if(len < 1e-6f)
+                continue; // the three points are on a line
+            float cos_up = (normal[0] * up[0] + normal[1] * up[1] + normal[2] * up[2]) / len;
+            if(std::abs(cos_up) < min_cos)
+                continue;
+            float sign = cos_up > 0.0f ? 1.0f : -1.0f;
+            ground_plane p;
+            p.a = sign * normal[0] / len;
+            p.b = sign * normal[1] / len;
+            p.c = sign * normal[2] / len;
+            p.d = -(p.a * xs[i] + p.b * ys[i] + p.c * zs[i]);
+            int s = score(p);
+            if(s > best_score[t])
+            {
+                best_score[t] = s;
+                best[t] = p;
+            }
+        }
+    });
+
+    int winner = std::max_element(best_score.begin(), best_score.end()) - best_score.begin();
+    if(best_score[winner] < params.min_ground_voxels)
+    {
+        has_plane = false;
+        return(false);
+    }
+    plane = best[winner];
+    has_plane = true;
+    return(true);
+}
+
+static int
+find_root(std::vector<int> &parent, int i)
+{
+    while(parent[i] != i)
+    {
+        parent[i] = parent[parent[i]]; // path halving
+        i = parent[i];
+    }
+    return(i);
+}
+
+// Groups the voxels between the ground and max_height into 26-connected clusters.
+// Each pair of neighbours is looked at once, from the voxel that comes first.
+void
+voxel_detector::cluster(std::vector<obstacle3d> &obstacles)
+{
+    std::vector<const voxel *> above;
+    std::vector<float> heights;
+    for(const voxel &v : grid)
+    {
+        float h = plane.height(v.x, v.y, v.z);
+        if(h > params.ground_tolerance && h <= params.max_height)
+        {
+            above.push_back(&v);
+            heights.push_back(h);
+        }
+    }
+
+    voxel_index index;
+    index.reset(above.size());
+    for(size_t i = 0; i < above.size(); i++)
+        index.insert(above[i]->key, i);
+
+    std::vector<int> parent(above.size());
+    for(size_t i = 0; i < parent.size(); i++)
+        parent[i] = i;
+    for(size_t i = 0; i < above.size(); i++)
+    {
+        int64_t ix, iy, iz;
+        unpack_key(above[i]->key, ix, iy, iz);
+        for(int dx = 0; dx <= 1; dx++)
+        for(int dy = -1; dy <= 1; dy++)
+        for(int dz = -1; dz <= 1; dz++)
+        {
+            // the 13 neighbours after this voxel, the other 13 see this one
+            if(dx == 0 && (dy < 0 || (dy == 0 && dz <= 0)))
+                continue;
+            int j = index.find(pack_key(ix + dx, iy + dy, iz + dz));
+            if(j < 0)
+                continue;
+            int a = find_root(parent, i), b = find_root(parent, j);
+            if(a != b)
+                parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    // boxes around whole cells, so the footprint errs on the large side
+    const float size = params.voxel_size;
+    std::vector<int> slot(above.size(), -1);
+    std::vector<obstacle3d> clusters;
+    for(size_t i = 0; i < above.size(); i++)
+    {
+        int root = find_root(parent, i);
+        if(slot[root] < 0)
+        {
+            slot[root] = clusters.size();
+            obstacle3d o;
+            for(int k = 0; k < 3; k++)
+            {
+                o.min[k] = INFINITY;
+                o.max[k] = -INFINITY;
+            }
+            o.height = 0.0f;
+            o.voxels = 0;
+            o.points = 0;
+            o.id = 0;
+            clusters.push_back(o);
+        }
+        obstacle3d &o = clusters[slot[root]];
+        int64_t cell[3];
+        unpack_key(above[i]->key, cell[0], cell[1], cell[2]);
+        for(int k = 0; k < 3; k++)
+        {
+            o.min[k] = std::min(o.min[k], cell[k] * size);
+            o.max[k] = std::max(o.max[k], (cell[k] + 1) * size);
+        }
+        o.height = std::max(o.height, heights[i]);
+        o.voxels++;
+        o.points += above[i]->count;
+    }
+
+    for(const obstacle3d &o : clusters)
+        if(o.voxels >= params.min_cluster_voxels)
+            obstacles.push_back(o);
+    std::sort(obstacles.begin(), obstacles.end(), [](const obstacle3d &a, const obstacle3d &b) {
+        return(a.min[2] < b.min[2]);
+    });
+    for(size_t i = 0; i < obstacles.size(); i++)
+        obstacles[i].id = i;
+}
+
+// header at the start of a point cloud file, followed by rows * cols * 4 floats
+struct cloud_header
+{
+    char magic[4];
+    uint32_t version;
+    int32_t rows;
+    int32_t cols;
+};
+
+static const char cloud_magic[4] = { 'Z', 'X', 'Y', 'Z' };
+static const uint32_t cloud_version = 1;
+
+bool
+save_cloud(const std::string &path, const float *xyz, int width, int height, size_t row_floats)
+{
+    std::ofstream out(path, std::ios::binary);
+    if(!out)
+        return(false);
+
+    cloud_header header;
+    memcpy(header.magic, cloud_magic, sizeof(header.magic));
+    header.version = cloud_version;
+    header.rows = height;
+    header.cols = width;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for(int i = 0; i < height; i++)
+        out.write(reinterpret_cast<const char *>(xyz + i * row_floats), width * 4 * sizeof(float));
+    return(out.good());
+}
+
+bool
+load_cloud(const std::string &path, std::vector<float> &xyz, int &width, int &height)
+{
+    std::ifstream in(path, std::ios::binary);
+    if(!in)
+        return(false);
+
+    cloud_header header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if(!in
+       || memcmp(header.magic, cloud_magic, sizeof(header.magic)) != 0
+       || header.version != cloud_version
+       || header.rows <= 0
+       || header.cols <= 0)
+        return(false);
+
+    width = header.cols;
+    height = header.rows;
+    xyz.resize((size_t) width * height * 4);
+    in.read(reinterpret_cast<char *>(xyz.data()), xyz.size() * sizeof(float));
+    return(in.good());
+}
@@ -0,0 +1,86 @@
+#ifndef VOXEL_H_   /* Include guard */
+#define VOXEL_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <random>
+#include <string>
+#include <vector>
+
+// tuning for the point cloud detector, all lengths in meters
+struct voxel_params
+{
+    float voxel_size = 0.1f;        // edge of one voxel
+    float max_range = 6.0f;         // points further ahead than this are dropped
+    float ground_tolerance = 0.08f; // voxels this close to the ground plane are ground
+    float max_height = 1.5f;        // voxels higher above the ground are overhangs, not obstacles
+    float max_tilt = 25.0f;         // degrees the ground may lean away from up
+    float up[3] = { 0.0f, -1.0f, 0.0f }; // roughly up in camera coordinates, the ZED's y points down
+    int point_stride = 2;           // use every nth row and column, a voxel spans several pixels anyway
+    int min_voxel_points = 2;       // voxels with fewer points are speckle
+    int min_cluster_voxels = 4;     // smaller clusters are noise
+    int min_ground_voxels = 50;     // a ground plane needs at least this many inliers
+    int ransac_iterations = 64;
+    int threads = 4;
+};
+
+// a * x + b * y + c * z + d = 0 with (a, b, c) a unit normal pointing up
+struct ground_plane
+{
+    float a, b, c, d;
+    float height(float x, float y, float z) const { return(a * x + b * y + c * z + d); }
+};
+
+// One obstacle as a box in camera coordinates, x right, y down, z ahead
+struct obstacle3d
+{
+    float min[3];
+    float max[3];
+    float height; // highest point above the ground
+    int voxels;
+    int points;
+    int id;       // index in the list, nearest first
+};
+
+// One cell of the voxel grid
+struct voxel
+{
+    uint64_t key;      // packed cell coordinates
+    float x, y, z;     // centroid of the points in it
+    int count;         // points in it
+};
+
+// Finds obstacles in a point cloud. The cloud is binned into a hashed voxel grid,
+// the ground plane is fitted to the voxels with RANSAC, and the voxels above the
+// ground are grouped into obstacles by 26-connectivity. Only voxels are touched
+// after the first pass, so the cost is mostly one sweep over the cloud.
+class voxel_detector
+{
+public:
+    voxel_detector(const voxel_params &params = voxel_params());
+
+    // xyz holds height rows of width points, 4 floats each (x, y, z and one unused),
+    // row_floats apart. NaN and inf points are skipped. Returns false if no ground
+    // plane was found, obstacles is empty then.
+    bool detect(const float *xyz, int width, int height, size_t row_floats, std::vector<obstacle3d> &obstacles);
+
+    const ground_plane &ground() const { return(plane); }
+    const std::vector<voxel> &voxels() const { return(grid); }
+
+private:
+    void build_grid(const float *xyz, int width, int height, size_t row_floats);
+    bool fit_ground();
+    void cluster(std::vector<obstacle3d> &obstacles);
+
+    voxel_params params;
+    ground_plane plane;
+    bool has_plane;          // plane holds last frame's ground, tried before any random plane
+    std::vector<voxel> grid;
+    std::minstd_rand rng;
+};
+
+// a raw point cloud for testing the detector off the rover, 4 floats per point
+bool save_cloud(const std::string &path, const float *xyz, int width, int height, size_t row_floats);
+bool load_cloud(const std::string &path, std::vector<float> &xyz, int &width, int &height);
+
+#endif // VOXEL_H_
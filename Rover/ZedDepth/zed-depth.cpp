@@ -4,297 +4,452 @@
 #include <vector>
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <cstdlib>
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/highgui.hpp>
-#include <sl/Camera.hpp>
 #include <thread>
+#include <memory>
 #include "server.h"
+#include "encoder.h"
+#include "capture.h"
+#include "source.h"
+#include "stereo.h"
+#ifndef NO_ZED
+#include "zedsource.h"
+#endif
+#include "obstacle.h"
+#include "ground.h"
+#include "segment.h"
+#include "depthseg.h"
+#include "tracker.h"
+#include "voxel.h"
+#include "timing.h"
+#include "ObstacleFeed.h"
+#include "telemetry.h"
 #include <glib.h>
 
-cv::Mat slMat2cvMat(const sl::Mat &input);
-sl::Camera zed;
+enum detect_mode
+{
+    MODE_WATERSHED, // bilateral filter, canny and watershed on the color image
+    MODE_GROUND,    // depth compared against a per-pixel ground model learned online
+    MODE_MULTIRES,  // watershed on a pyramid level, refined at full resolution
+    MODE_VOXEL,     // voxel grid of the point cloud, ground plane and 3D clusters
+    MODE_DEPTH      // connected components of the depth map, split at depth steps
+};
+
+// the camera with what was found on it, and the watershed view of debug builds
+#define STREAM_PORT "5556"
+#define DEBUG_STREAM_PORT "8888"
+
 cv::VideoWriter writer;
 cv::VideoWriter writer_debug;
 int32_t new_width;
 int32_t new_height;
 
+frame_slot frames;
+
+// time between saves of the ground model. Detection skips frames, so frame
+// numbers can't tell when it is time.
+constexpr std::chrono::seconds ground_save_interval(20);
+
+// The only thread that grabs from the camera after setup. Each frame is shared
+// with the stream and detection as it is. Closes frames at the end of a recording.
 void
-getSomeImages()
+capture_frames(depth_source *source)
 {
-  sl::Mat img_zed(new_width, new_height, sl::MAT_TYPE_8U_C4);
-
-  for(;;)
-  {
-    zed.retrieveImage(img_zed, sl::VIEW_LEFT, sl::MEM_CPU, new_width, new_height);
-    cv::Mat three_channel_bgr;
-    cv::Mat img_cv = slMat2cvMat(img_zed);
-    cv::cvtColor(img_cv, three_channel_bgr, cv::COLOR_BGRA2BGR);
-    writer.write(three_channel_bgr);
-    std::this_thread::sleep_for(std::chrono::milliseconds(20));
-  }
+    for(uint64_t number = 1; ; )
+    {
+        frame f;
+        grab_result result = source->grab(f);
+        if(result == GRAB_END)
+            break;
+        if(result == GRAB_RETRY)
+            continue;
+        f.number = number++;
+        frames.publish(f);
+    }
+    frames.close();
 }
 
-cv::Mat slMat2cvMat(const sl::Mat &input)
+// streams every captured frame once, paced by the camera
+void
+stream_frames()
 {
-    // Mapping between MAT_TYPE and CV_TYPE
-    int cv_type = -1;
-    switch (input.getDataType())
+    frame f;
+    // converting and encoding is only worth it while someone watches
+    while(frames.wait_newer(f.number, f))
+        if(watched(STREAM_PORT))
+            writer.write(f.bgr);
+}
+
+// hands the obstacles of this frame to the planner through shared memory
+void
+publish_obstacles(RoverPathfinding::ObstacleFeedWriter &feed,
+                  const std::vector<obstacle> &obstacles,
+                  const camera_intrinsics &cam,
+                  uint64_t timestamp_ns)
+{
+    RoverPathfinding::ObstacleFrame *frame = feed.Begin();
+    frame->timestamp_ns = timestamp_ns;
+    frame->count = 0;
+    for(const obstacle &o : obstacles)
     {
-    case sl::MAT_TYPE_32F_C1: cv_type = CV_32FC1; break;
-    case sl::MAT_TYPE_32F_C2: cv_type = CV_32FC2; break;
-    case sl::MAT_TYPE_32F_C3: cv_type = CV_32FC3; break;
-    case sl::MAT_TYPE_32F_C4: cv_type = CV_32FC4; break;
-    case sl::MAT_TYPE_8U_C1: cv_type = CV_8UC1; break;
-    case sl::MAT_TYPE_8U_C2: cv_type = CV_8UC2; break;
-    case sl::MAT_TYPE_8U_C3: cv_type = CV_8UC3; break;
-    case sl::MAT_TYPE_8U_C4: cv_type = CV_8UC4; break;
-    default: break;
+        if(frame->count == OBSTACLE_FEED_MAX)
+            break;
+        // pinhole camera, x = (u - cx) * z / fx
+        RoverPathfinding::ObstacleRecord &r = frame->records[frame->count++];
+        r.x_left = (o.rect.x - cam.cx) * o.distance / cam.fx;
+        r.x_right = (o.rect.x + o.rect.width - cam.cx) * o.distance / cam.fx;
+        r.depth = o.distance;
+        r.id = o.id;
     }
+    feed.Commit();
+}
 
-    // Since cv::Mat data requires a uchar* pointer, we get the uchar1 pointer from sl::Mat (getPtr<T>())
-    // cv::Mat and sl::Mat will share a single memory structure
-    return cv::Mat(input.getHeight(), input.getWidth(), cv_type, input.getPtr<sl::uchar1>(sl::MEM_CPU));
+// same for obstacles from the point cloud, which already know where they are
+void
+publish_obstacles3d(RoverPathfinding::ObstacleFeedWriter &feed,
+                    const std::vector<obstacle3d> &obstacles,
+                    uint64_t timestamp_ns)
+{
+    RoverPathfinding::ObstacleFrame *frame = feed.Begin();
+    frame->timestamp_ns = timestamp_ns;
+    frame->count = 0;
+    for(const obstacle3d &o : obstacles)
+    {
+        if(frame->count == OBSTACLE_FEED_MAX)
+            break;
+        RoverPathfinding::ObstacleRecord &r = frame->records[frame->count++];
+        r.x_left = o.min[0];
+        r.x_right = o.max[0];
+        r.depth = o.min[2];
+        r.id = o.id;
+    }
+    feed.Commit();
 }
 
-int main(int argc, char *argv[])
+// the front face of a 3D obstacle in the image, for the debug view and telemetry
+obstacle
+project_obstacle(const obstacle3d &o, const camera_intrinsics &cam, int point_stride)
 {
-    sl::InitParameters init_params;
-    init_params.camera_resolution = sl::RESOLUTION_VGA;
-    init_params.depth_mode = sl::DEPTH_MODE_QUALITY;
-    init_params.coordinate_units = sl::UNIT_METER;
+    float z = std::max(o.min[2], 0.1f);
+    cv::Point tl(cvRound(o.min[0] * cam.fx / z + cam.cx), cvRound(o.min[1] * cam.fy / z + cam.cy));
+    cv::Point br(cvRound(o.max[0] * cam.fx / z + cam.cx), cvRound(o.max[1] * cam.fy / z + cam.cy));
+    cv::Rect rect(tl, br);
+    // the detector only looked at every point_stride-th row and column
+    int area = std::min(o.points * point_stride * point_stride, rect.area());
+    return({ rect, o.min[2], area, o.id });
+}
 
-    if(zed.open(init_params) != sl::SUCCESS)
+// sends the boxes of this frame to whoever watches over --telemetry
+void
+send_telemetry(telemetry_sender &telemetry,
+               const std::vector<obstacle> &obstacles,
+               const frame &f,
+               detect_mode mode)
+{
+    std::vector<telemetry_obstacle> records;
+    for(const obstacle &o : obstacles)
     {
-        std::cout << "Failed to open camera.\n";
-        return(1);
+        telemetry_obstacle r;
+        cv::Rect rect = o.rect & cv::Rect(0, 0, f.bgr.cols, f.bgr.rows);
+        r.x = rect.x;
+        r.y = rect.y;
+        r.width = rect.width;
+        r.height = rect.height;
+        r.distance_mm = (uint16_t) std::min(std::max(o.distance, 0.0f) * 1000.0f, 65535.0f);
+        r.id = o.id;
+        r.confidence = o.rect.area() > 0 ? (uint8_t) std::min(255 * o.area / o.rect.area(), 255) : 0;
+        r.reserved = 0;
+        records.push_back(r);
     }
+    telemetry.send(f.timestamp_ns, mode, f.bgr.cols, f.bgr.rows, records);
+}
+
+// returns true if a --name flag was given
+bool
+has_arg(int argc, char *argv[], const char *name)
+{
+    for(int i = 1; i < argc; i++)
+        if(strcmp(argv[i], name) == 0)
+            return(true);
+    return(false);
+}
 
-    sl::RuntimeParameters runtime_params;
-    runtime_params.sensing_mode = sl::SENSING_MODE_STANDARD;
-    runtime_params.enable_point_cloud = false;
-    sl::Resolution image_size = zed.getResolution();
+// returns the value of a --name=value argument, or fallback if it was not given
+const char *
+get_arg(int argc, char *argv[], const char *name, const char *fallback)
+{
+    size_t len = strlen(name);
+    for(int i = 1; i < argc; i++)
+        if(strncmp(argv[i], name, len) == 0 && argv[i][len] == '=')
+            return(argv[i] + len + 1);
+    return(fallback);
+}
 
-    // scale image ?
-    //new_width = image_size.width / 2;
-    //new_height = image_size.height / 2;
+int main(int argc, char *argv[])
+{
+    // ./zed-depth [--mode=watershed|ground|multires|voxel|depth] [--ground=ground.bin] [--latency=ms] [--track] [--fps=15] [--bitrate=kbit/s] [--standby=10] [--filter=bilateral|guided|domain|fixed|none] [--telemetry=host:5557] [--source=zed|stereo] [--stereo=0|video.mp4] [--calib=stereo.yml]
+    detect_mode mode = MODE_WATERSHED;
+    const char *mode_arg = get_arg(argc, argv, "--mode", "watershed");
+    if(strcmp(mode_arg, "watershed") == 0)
+        mode = MODE_WATERSHED;
+    else if(strcmp(mode_arg, "ground") == 0)
+        mode = MODE_GROUND;
+    else if(strcmp(mode_arg, "multires") == 0)
+        mode = MODE_MULTIRES;
+    else if(strcmp(mode_arg, "voxel") == 0)
+        mode = MODE_VOXEL;
+    else if(strcmp(mode_arg, "depth") == 0)
+        mode = MODE_DEPTH;
+    else
+    {
+        std::cout << "Unknown mode " << mode_arg << ", use --mode=watershed|ground|multires|voxel|depth.\n";
+        return(1);
+    }
+    std::string ground_path = get_arg(argc, argv, "--ground", "ground.bin");
+    ground_params ground_settings;
+    watershed_params watershed_settings;
+    depth_segment_params depth_settings;
+    const char *filter_arg = get_arg(argc, argv, "--filter", "bilateral");
+    if(!parse_smooth_filter(filter_arg, watershed_settings.smooth.filter))
+    {
+        std::cout << "Unknown filter " << filter_arg << ", see smooth.h.\n";
+        return(1);
+    }
+    multires_segmenter multires(atof(get_arg(argc, argv, "--latency", "50")));
+    bool track = has_arg(argc, argv, "--track");
+    int fps = atoi(get_arg(argc, argv, "--fps", "15"));
+    obstacle_tracker tracker;
+    voxel_detector voxels;
+
+    // depth from the ZED SDK on the GPU, or from stereo matching on the CPU
+#ifdef NO_ZED
+    const char *source_arg = get_arg(argc, argv, "--source", "stereo");
+#else
+    const char *source_arg = get_arg(argc, argv, "--source", "zed");
+#endif
+    std::unique_ptr<depth_source> source;
+    if(strcmp(source_arg, "stereo") == 0)
+        source.reset(new stereo_source(get_arg(argc, argv, "--stereo", "0"), get_arg(argc, argv, "--calib", "stereo.yml")));
+#ifndef NO_ZED
+    else if(strcmp(source_arg, "zed") == 0)
+        source.reset(new zed_source());
+#endif
+    if(!source)
+    {
+        std::cout << "Unknown source " << source_arg << ".\n";
+        return(1);
+    }
+    if(!source->open(fps, mode == MODE_VOXEL))
+    {
+        std::cout << "Failed to open camera.\n";
+        return(1);
+    }
+    cv::Size image_size = source->size();
+    camera_intrinsics left_cam = source->intrinsics();
+
+    // obstacles go straight to the planner, see Rover/Map/ObstacleFeed.h
+    RoverPathfinding::ObstacleFeedWriter feed;
+    bool feed_open = feed.Open();
+    if(!feed_open)
+        std::cout << "Failed to open the obstacle feed, obstacles will not reach the planner.\n";
+
+    // a few hundred bytes per frame instead of the debug video, see telemetry-recv
+    telemetry_sender telemetry;
+    const char *telemetry_arg = get_arg(argc, argv, "--telemetry", nullptr);
+    if(telemetry_arg && !telemetry.open(telemetry_arg))
+        std::cout << "Failed to open telemetry to " << telemetry_arg << ".\n";
+
+    // --mode=multires picks its own scale every frame
     new_width = image_size.width;
     new_height = image_size.height;
 
-    sl::Mat img_zed(new_width, new_height, sl::MAT_TYPE_8U_C4);
-
-    // depth images
-    sl::Mat depth_img_zed(new_width, new_height, sl::MAT_TYPE_8U_C4);
-    cv::Mat depth_img_cv = slMat2cvMat(depth_img_zed);
-
-    sl::Mat sl_depth_f32;
+    // the ground model keeps learning while zed-depth runs, save-depth only gives it a head start
+    ground_model ground;
+    if(mode == MODE_GROUND)
+    {
+        cv::Size depth_size = image_size;
+        if(!ground.load(ground_path))
+        {
+            std::cout << "No ground model in " << ground_path << ", learning one from scratch. Keep the view clear for the first few seconds.\n";
+            ground.reset(depth_size);
+        }
+        // depth is measured at the camera resolution
+        else if(ground.size() != depth_size)
+            ground.resize(depth_size);
+    }
+    // the streams are encoded with whatever the machine has, see encoder.h
+    gst_init(NULL, NULL);
+    int bitrate = atoi(get_arg(argc, argv, "--bitrate", "0"));
+    standby_seconds = atoi(get_arg(argc, argv, "--standby", "10"));
+    if(bitrate <= 0)
+        bitrate = default_bitrate(new_width, new_height, fps);
+    std::string rgb_mount = "intervideosrc channel=rgb ! " + encoder_rtp(bitrate, fps);
 
     g_server_data data;
     data.argc = 5;
     data.argv[0] = argv[0];
     data.argv[1] = "intervideosrc";
     data.argv[2] = "zed_depth";
-    data.argv[3] = "5556";
-    data.argv[4] = "intervideosrc channel=rgb ! rtpvrawpay name=pay0 pt=96";
+    data.argv[3] = STREAM_PORT;
+    data.argv[4] = rgb_mount.c_str();
     
-    writer.open("appsrc ! video/x-raw,format=BGR ! videoconvert ! video/x-raw,format=I420 ! intervideosink channel=rgb", 0, 10, cv::Size(img_zed.getWidth(), img_zed.getHeight()), true);
+    writer.open("appsrc ! video/x-raw,format=BGR ! videoconvert ! video/x-raw,format=I420 ! intervideosink channel=rgb", 0, fps, cv::Size(new_width, new_height), true);
 
     std::thread t1(start_server, data.argc, (char **) data.argv);
-    std::thread t2(getSomeImages);
+    std::thread t2(capture_frames, source.get());
+    std::thread t4(stream_frames);
 
 #ifdef DEBUG
+    std::string wshed_mount = "intervideosrc channel=wshed ! " + encoder_rtp(bitrate, 10);
     g_server_data data2;
     data2.argc = 5;
     data2.argv[0] = argv[0];
     data2.argv[1] = "intervideosrc";
     data2.argv[2] = "zed_depth_debug";
-    data2.argv[3] = "8888";
-    data2.argv[4] = "intervideosrc channel=wshed ! rtpvrawpay name=pay0 pt=96";
+    data2.argv[3] = DEBUG_STREAM_PORT;
+    data2.argv[4] = wshed_mount.c_str();
  
-    writer_debug.open("appsrc ! video/x-raw,format=BGR ! videoconvert ! video/x-raw,format=I420 ! intervideosink channel=wshed", 0, 10, cv::Size(img_zed.getWidth(), img_zed.getHeight()), true);
+    writer_debug.open("appsrc ! video/x-raw,format=BGR ! videoconvert ! video/x-raw,format=I420 ! intervideosink channel=wshed", 0, 10, cv::Size(new_width, new_height), true);
 
     std::thread t3(start_server, data2.argc, (char **) data2.argv);
 #endif
 
-    for(char key = ' '; key != 'q'; key = cv::waitKey(10))
+    // detection works on the newest frame and skips any it was too slow for
+    frame f;
+    auto last_ground_save = std::chrono::steady_clock::now();
+    while(frames.wait_newer(f.number, f))
     {
-        if(zed.grab(runtime_params) == sl::SUCCESS)
+        if(mode == MODE_GROUND)
         {
-            // get depth map form zed
-            zed.retrieveImage(img_zed, sl::VIEW_LEFT, sl::MEM_CPU, new_width, new_height);
-            zed.retrieveImage(depth_img_zed, sl::VIEW_DEPTH, sl::MEM_CPU, new_width, new_height);
-            zed.retrieveMeasure(sl_depth_f32, sl::MEASURE_DEPTH);
-
-            std::vector<cv::Vec4i> hierarchy;
-            cv::Mat edges, blur_kern;
-            std::vector<std::vector<cv::Point> > contours;
-
-            cv::Mat img_cv = slMat2cvMat(img_zed);
-#define TIME std::chrono::duration<float, std::milli>(end - start).count()
-#define NOW std::chrono::high_resolution_clock::now();
+            const cv::Mat &depth_f32 = f.depth;
+
             auto start = NOW;
-            // blur image
-            cv::cvtColor(img_cv, img_cv, CV_8U, 3);
-            cv::Mat img_cv_blur(img_cv.size(), CV_8UC3);
-            cv::bilateralFilter(img_cv, img_cv_blur, 9, 150.0, 150.0,  cv::BORDER_DEFAULT);
-
-            // setup for contours for regular image
-            cv::resize(img_cv_blur, img_cv_blur, cv::Size(new_width, new_height));
-            cv::Canny(img_cv_blur, edges, 100, 200);
-            
+            std::vector<obstacle> obstacles;
+            cv::Mat mask;
+            find_ground_obstacles(depth_f32, ground, ground_settings, obstacles, mask);
             auto end = NOW;
             auto ms = TIME;
-            std::cout << "Preprocessing Time: " << ms << " ms\n";
+            std::cout << "Ground Time: " << ms << " ms, " << obstacles.size() << " obstacles\n";
 
+            // learn from everything but the obstacles, with a margin for their blurry edges
             start = NOW;
-            // make contours for watershed with 8-bit single-channel image
-            cv::findContours(edges, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-            if(hierarchy.empty())
-                continue;
-            // make contours to cv mat
-            cv::Mat contour_img(edges.size(), CV_32S);
-            cv::Mat contour_img_visible(edges.size(), CV_32S);
-
-            // reset contours
-            contour_img = 0;
-            contour_img_visible = 0;
-            int idx = 0;
-            int comp_count = 0;
-            for(; idx >= 0; idx = hierarchy[idx][0], comp_count++)
+            cv::Mat skip;
+            cv::dilate(mask, skip, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(9, 9)));
+            ground.update(depth_f32, ground_settings.max_count, skip);
+            end = NOW;
+            std::cout << "Ground Update Time: " << TIME << " ms\n";
+            if(std::chrono::steady_clock::now() - last_ground_save >= ground_save_interval)
             {
-                cv::drawContours(contour_img, 
-                                 contours, 
-                                 idx, 
-                                 cv::Scalar::all(idx), 
-                                 -1, 
-                                 8, 
-                                 hierarchy, 
-                                 1);
-
-                cv::drawContours(contour_img_visible, 
-                                 contours, 
-                                 idx, 
-                                 cv::Scalar::all(INT_MAX), 
-                                 -1, 
-                                 8, 
-                                 hierarchy, 
-                                 1);
+                last_ground_save = std::chrono::steady_clock::now();
+                if(!ground.save(ground_path))
+                    std::cout << "Failed to write " << ground_path << "\n";
             }
 
-            // convert to cv mat
-            cv::Mat cv_depth_f32 = slMat2cvMat(sl_depth_f32);
-            cv::Mat depth_f32;
-            cv::resize(cv_depth_f32, depth_f32, cv::Size(new_width, new_height));
-            cv::Mat three_channel_img;
-            cv::cvtColor(img_cv_blur, three_channel_img, cv::COLOR_BGRA2BGR);
-
-            cv::Mat bork;
-            contour_img_visible.convertTo(bork, CV_8U, 255);
-            //cv::imshow("contours", bork);
+#ifdef DEBUG
+            cv::Mat ground_view;
+            cv::cvtColor(mask, ground_view, cv::COLOR_GRAY2BGR);
+            draw_obstacles(ground_view, obstacles);
+            if(watched(DEBUG_STREAM_PORT))
+                writer_debug.write(ground_view);
+#endif
+            if(feed_open)
+                publish_obstacles(feed, obstacles, left_cam, f.timestamp_ns);
+            send_telemetry(telemetry, obstacles, f, mode);
+            continue;
+        }
 
-            end = NOW;
-            ms = TIME;
-            std::cout << "Contours Time: " << ms << " ms\n";
+        if(mode == MODE_VOXEL)
+        {
+            auto start = NOW;
+            std::vector<obstacle3d> found;
+            bool ground_found = voxels.detect(f.xyz.ptr<float>(), f.xyz.cols, f.xyz.rows, f.xyz.step1(), found);
+            auto end = NOW;
+            std::cout << "Voxel Time: " << TIME << " ms, " << voxels.voxels().size() << " voxels, " << found.size() << " obstacles\n";
+            if(!ground_found)
+                std::cout << "No ground plane in view\n";
 
-            start = NOW;
-            // watershed the image
-            cv::watershed(three_channel_img, contour_img);
-            cv::Mat wshed(contour_img.size(), CV_8UC3);
+            std::vector<obstacle> projected;
+            for(const obstacle3d &o : found)
+                projected.push_back(project_obstacle(o, left_cam, voxel_params().point_stride));
+#ifdef DEBUG
+            cv::Mat voxel_view = f.bgr.clone();
+            draw_obstacles(voxel_view, projected);
+            if(watched(DEBUG_STREAM_PORT))
+                writer_debug.write(voxel_view);
+#endif
+            if(feed_open)
+                publish_obstacles3d(feed, found, f.timestamp_ns);
+            send_telemetry(telemetry, projected, f, mode);
+            continue;
+        }
 
-            end = NOW;
-            ms = TIME;
-            std::cout << "Watershed Time: " << ms << " ms\n";
+        const cv::Mat &bgr = f.bgr;
+        const cv::Mat &depth_f32 = f.depth;
 
-            start = NOW;
-            // for each segment in watershed image make color
-            cv::Mat temp, temp_f32;
-            std::vector<cv::Vec3b> colors(comp_count);
-            std::vector<bool> obstacle(comp_count);
-            std::vector<std::pair<cv::Rect, float> > rects(comp_count);
-            for(int i = 0; i < comp_count; i++)
+        std::vector<obstacle> obstacles;
+        cv::Mat wshed;
+#ifdef DEBUG
+        cv::Mat *view = &wshed;
+#else
+        cv::Mat *view = nullptr;
+#endif
+        cv::Mat gray;
+        if(track)
+            cv::cvtColor(bgr, gray, cv::COLOR_BGR2GRAY);
+
+        // between keyframes the tracker moves the last segmentation along instead
+        auto start = NOW;
+        bool tracked = track && tracker.update(gray, depth_f32);
+        auto end = NOW;
+        if(tracked)
+        {
+            tracker.get_obstacles(obstacles);
+            std::cout << "Tracking Time: " << TIME << " ms\n";
+            if(view)
             {
-                colors[i] = cv::Vec3b(0, rand() % 255, 0);
-                cv::inRange(contour_img, i, i, temp);
-                
-                // convert this mat to f32
-                temp.convertTo(temp_f32, CV_32F, 1.0f / 255.0f);
-                
-                // size in pixels of segments to filter out
-                double dist;
-                cv::minMaxLoc(depth_f32.mul(temp_f32), nullptr, &dist);
-                float z = static_cast<float>(dist);
-
-                rects[i] = std::make_pair(cv::boundingRect(temp), z);
-                
-                int nonzero = cv::countNonZero(temp);
-                obstacle[i] = 5000 <= nonzero && nonzero <= 200000
-                    && rects[i].first.y + rects[i].first.height < contour_img.rows - 1
-                    && z != NAN
-                    && z > 0
-                    && z <= 6.0;
+                *view = bgr.clone();
+                draw_obstacles(*view, obstacles);
             }
-            end = NOW;
-            ms = TIME;
-            std::cout << "Obstacles Time: " << ms << " ms\n";
-
-            start = NOW;
-            // put color in segment
-            cv::Mat wshed_mask(contour_img.size(), CV_8UC3);
-            for(int i = 0; i < contour_img.rows; i++)
-                for(int j = 0; j < contour_img.cols; j++)
-                {
-                    int index = contour_img.at<int>(i, j);
-                    if(index == -1)
-                        wshed.at<cv::Vec3b>(i, j) = cv::Vec3b(255, 255, 255);
-                    else if(index <= 0 || index > comp_count || !obstacle[index])
-                        wshed.at<cv::Vec3b>(i, j) = cv::Vec3b(0, 0, 0);                    
-                    else
-                        wshed.at<cv::Vec3b>(i, j) = colors[index];
-                }
-            for(int i = 0; i < comp_count; i++)
+        }
+        else
+        {
+            cv::Mat markers;
+            if(mode == MODE_DEPTH)
+                segment_depth(depth_f32, depth_settings, obstacles, markers, view);
+            else if(mode == MODE_MULTIRES)
+                multires.segment(bgr, depth_f32, watershed_settings, obstacles, view);
+            else
+                segment_watershed(bgr, depth_f32, watershed_settings, obstacles, markers, view);
+
+            if(track)
             {
-                constexpr int thickness = 6;
-                if(!obstacle[i])
-                    continue;
-                auto rect = rects[i].first;
-                cv::rectangle(wshed, rect, cv::Scalar(0, 0, 255), thickness);
-                std::ostringstream ss;
-                ss << rects[i].second << " meters";
-                cv::putText(wshed,
-                            ss.str(),
-                            cv::Point(rect.x + thickness, rect.y + rect.height - thickness),
-                            cv::FONT_HERSHEY_SIMPLEX,
-                            0.4,
-                            cv::Scalar(0, 255, 0));
-
+                tracker.reset(gray, depth_f32, obstacles, markers);
+                tracker.get_obstacles(obstacles);
             }
-            end = NOW;
-            ms = TIME;
-            std::cout << "Coloring Time: " << ms << " ms\n";
-            std::cout << std::endl;
-            
-            //cv::imshow("watershed", wshed);
+        }
+        std::cout << std::endl;
+
+        if(feed_open)
+            publish_obstacles(feed, obstacles, left_cam, f.timestamp_ns);
+        send_telemetry(telemetry, obstacles, f, mode);
+
+        //cv::imshow("watershed", wshed);
 #ifdef DEBUG
+        if(watched(DEBUG_STREAM_PORT))
             writer_debug.write(wshed);
 #endif
-#if 0
-            cv::Mat three_channel;
-            cv::cvtColor(depth_img_cv, three_channel, cv::COLOR_BGRA2BGR);
-            cv::applyColorMap(three_channel, bgr, cv::COLORMAP_JET);
-            cv::imshow("Original", image_cv);
-            cv::imshow("Depth", depth_img_cv);
-            cv::imshow("Depth", bgr);
-            cv::imshow("Depth2", cv_depth_u8);
-            cv::imshow("Point Cloud", point_cloud_cv);
-            cv::imshow("Depth Measure", cv_depth_f32);
-#endif
-        }
-        else
-        {
-            std::cout << "Failed to grab frame.\n";
-        }        
     }
-    
-    zed.close();
+
+    // only a recording ends, the RTSP servers go down with the process
+    t2.join();
+    t4.join();
+    t1.detach();
+#ifdef DEBUG
+    t3.detach();
+#endif
     return(0);
 }
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <opencv2/imgproc.hpp>
+
+#include "zedsource.h"
+
+zed_source::~zed_source()
+{
+    zed.close();
+}
+
+bool
+zed_source::open(int fps, bool point_cloud)
+{
+    sl::InitParameters init_params;
+    init_params.camera_resolution = sl::RESOLUTION_VGA;
+    init_params.depth_mode = sl::DEPTH_MODE_QUALITY;
+    init_params.coordinate_units = sl::UNIT_METER;
+    init_params.camera_fps = fps;
+    if(zed.open(init_params) != sl::SUCCESS)
+        return(false);
+
+    runtime_params.sensing_mode = sl::SENSING_MODE_STANDARD;
+    runtime_params.enable_point_cloud = point_cloud;
+    sl::Resolution image_size = zed.getResolution();
+    width = image_size.width;
+    height = image_size.height;
+    image.alloc(width, height, sl::MAT_TYPE_8U_C4);
+    image_cv = slMat2cvMat(image);
+    sl::CameraParameters left_cam = zed.getCameraInformation().calibration_parameters.left_cam;
+    cam = { left_cam.fx, left_cam.fy, left_cam.cx, left_cam.cy };
+    return(true);
+}
+
+// Returns a buffer from the pool that no frame uses anymore, or a new one.
+// Nobody can take a new reference to a buffer the pool alone holds, so the count is safe.
+std::shared_ptr<sl::Mat>
+zed_source::free_buffer(std::vector<std::shared_ptr<sl::Mat> > &pool, sl::MAT_TYPE type)
+{
+    for(auto &buffer : pool)
+        if(buffer.use_count() == 1)
+            return(buffer);
+    pool.push_back(std::make_shared<sl::Mat>(width, height, type));
+    return(pool.back());
+}
+
+// Every grabbed frame is retrieved and converted to BGR once. The point cloud is
+// only retrieved when it was asked for in open().
+grab_result
+zed_source::grab(frame &f)
+{
+    if(zed.grab(runtime_params) != sl::SUCCESS)
+    {
+        std::cout << "Failed to grab frame.\n";
+        return(GRAB_RETRY);
+    }
+
+    std::shared_ptr<sl::Mat> depth = free_buffer(depth_pool, sl::MAT_TYPE_32F_C1);
+    zed.retrieveImage(image, sl::VIEW_LEFT, sl::MEM_CPU, width, height);
+    zed.retrieveMeasure(*depth, sl::MEASURE_DEPTH, sl::MEM_CPU, width, height);
+    cv::cvtColor(image_cv, f.bgr, cv::COLOR_BGRA2BGR);
+    f.depth = slMat2cvMat(*depth);
+    f.depth_buffer = depth;
+    if(runtime_params.enable_point_cloud)
+    {
+        std::shared_ptr<sl::Mat> cloud = free_buffer(cloud_pool, sl::MAT_TYPE_32F_C4);
+        zed.retrieveMeasure(*cloud, sl::MEASURE_XYZ, sl::MEM_CPU, width, height);
+        f.xyz = slMat2cvMat(*cloud);
+        f.xyz_buffer = cloud;
+    }
+    f.timestamp_ns = zed.getTimestamp(sl::TIME_REFERENCE_IMAGE);
+    return(GRAB_OK);
+}
+
+cv::Mat slMat2cvMat(const sl::Mat &input)
+{
+    // Mapping between MAT_TYPE and CV_TYPE
+    int cv_type = -1;
+    switch (input.getDataType())
+    {
+    case sl::MAT_TYPE_32F_C1: cv_type = CV_32FC1; break;
+    case sl::MAT_TYPE_32F_C2: cv_type = CV_32FC2; break;
+    case sl::MAT_TYPE_32F_C3: cv_type = CV_32FC3; break;
+    case sl::MAT_TYPE_32F_C4: cv_type = CV_32FC4; break;
+    case sl::MAT_TYPE_8U_C1: cv_type = CV_8UC1; break;
+    case sl::MAT_TYPE_8U_C2: cv_type = CV_8UC2; break;
+    case sl::MAT_TYPE_8U_C3: cv_type = CV_8UC3; break;
+    case sl::MAT_TYPE_8U_C4: cv_type = CV_8UC4; break;
+    default: break;
+    }
+
+    // Since cv::Mat data requires a uchar* pointer, we get the uchar1 pointer from sl::Mat (getPtr<T>())
+    // cv::Mat and sl::Mat will share a single memory structure
+    return cv::Mat(input.getHeight(), input.getWidth(), cv_type, input.getPtr<sl::uchar1>(sl::MEM_CPU));
+}
@@ -0,0 +1,36 @@
+#ifndef ZEDSOURCE_H_   /* Include guard */
+#define ZEDSOURCE_H_
+
+#include <memory>
+#include <vector>
+#include <sl/Camera.hpp>
+#include "source.h"
+
+// Frames and depth from the ZED SDK. Depth is computed on the GPU.
+class zed_source : public depth_source
+{
+public:
+    ~zed_source();
+    bool open(int fps, bool point_cloud) override;
+    grab_result grab(frame &f) override;
+    cv::Size size() const override { return(cv::Size(width, height)); }
+    camera_intrinsics intrinsics() const override { return(cam); }
+
+private:
+    std::shared_ptr<sl::Mat> free_buffer(std::vector<std::shared_ptr<sl::Mat> > &pool, sl::MAT_TYPE type);
+
+    sl::Camera zed;
+    sl::RuntimeParameters runtime_params;
+    sl::Mat image;    // BGRA left image
+    cv::Mat image_cv; // shares the memory of image
+    std::vector<std::shared_ptr<sl::Mat> > depth_pool;
+    std::vector<std::shared_ptr<sl::Mat> > cloud_pool;
+    camera_intrinsics cam;
+    int width = 0;
+    int height = 0;
+};
+
+// a cv::Mat that shares the memory of an sl::Mat
+cv::Mat slMat2cvMat(const sl::Mat &input);
+
+#endif // ZEDSOURCE_H_